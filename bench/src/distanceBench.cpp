@@ -0,0 +1,160 @@
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#include <utils/EntityState.h>
+#include <utils/FaceDistance.h>
+#include <utils/ThreadPool.h>
+
+// Compares the per pair l2Distance loop the lambda used against the batched
+// kernel. Dense builds give every state a 64 KB covariance, so the baseline
+// points at bare means through shared_ptr to keep 100k candidates in memory.
+// Then compares the quadruple loop fasim used for its pairwise distances
+// against the blocked pairwise kernel feeding a histogram.
+
+#define MATCHING_THRESH 140.0
+#define REPEATS 20
+
+typedef std::chrono::high_resolution_clock Clock;
+
+double perPairLoop(const FFVec& query, const std::vector<std::shared_ptr<FFVec>>& pool, std::vector<float>& distances) {
+    auto start = Clock::now();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int i = 0; i < pool.size(); i++) {
+            distances[i] = l2Distance(query, *pool[i]);
+        }
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / REPEATS;
+}
+
+double batched(const FFVec& query, const FaceMatrix& means, std::vector<float>& distances) {
+    auto start = Clock::now();
+    for (int r = 0; r < REPEATS; r++) {
+        batchL2Distance(query, means, distances);
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / REPEATS;
+}
+
+double batchedMatches(const FFVec& query, const FaceMatrix& means, std::vector<FaceMatch>& matches) {
+    auto start = Clock::now();
+    for (int r = 0; r < REPEATS; r++) {
+        batchL2Matches(query, means, MATCHING_THRESH, matches, 10);
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / REPEATS;
+}
+
+// Seconds for the pairwise loop over nested vectors, as uploadDataSet had it
+double pairwiseLoop(const std::vector<std::vector<float>>& faces, DistanceHistogram& histogram) {
+    auto start = Clock::now();
+    for (int i = 0; i < faces.size(); i++) {
+        for (int j = i + 1; j < faces.size(); j++) {
+            float distance = 0.0;
+            for (int k = 0; k < FACE_VEC_SIZE; k++) {
+                distance += pow(faces[i][k] - faces[j][k], 2);
+            }
+            histogram.add(distance);
+        }
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double pairwiseBlocked(const std::vector<float>& faces, ThreadPool& pool, DistanceHistogram& histogram) {
+    auto start = Clock::now();
+    std::vector<DistanceHistogram> histograms(pool.size() + 1);
+    pairwiseL2Distances(faces.data(), faces.size() / FACE_VEC_SIZE, pool, [&](const DistanceTile& tile) {
+        DistanceHistogram& local = histograms[ThreadPool::workerIndex() + 1];
+        for (int r = 0; r < tile.rows; r++) {
+            for (int c = 0; c < tile.cols; c++) {
+                if (tile.colBegin + c > tile.rowBegin + r) {
+                    local.add(tile.distances[r * tile.cols + c]);
+                }
+            }
+        }
+    });
+    for (const DistanceHistogram& local : histograms) {
+        histogram.merge(local);
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main() {
+
+    fmt::println("Face distance kernel: {}", faceDistanceKernel());
+    fmt::println("{:>10} {:>14} {:>14} {:>14} {:>10} {:>12}", "candidates", "per pair (us)", "batched (us)", "top-k (us)", "speedup", "max error");
+
+    std::mt19937 gen(5678975);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    for (int n : { 1000, 10000, 100000 }) {
+        std::vector<std::shared_ptr<FFVec>> pool;
+        FaceMatrix means;
+        means.reserve(n);
+        for (int i = 0; i < n; i++) {
+            std::shared_ptr<FFVec> features(new FFVec());
+            for (int k = 0; k < FACE_VEC_SIZE; k++) {
+                (*features)[k] = dist(gen);
+            }
+            means.add(*features);
+            pool.push_back(features);
+        }
+        // shuffle the pointers so the baseline sees the scattered heap it gets in practice
+        std::shuffle(pool.begin(), pool.end(), gen);
+
+        FFVec query;
+        for (int k = 0; k < FACE_VEC_SIZE; k++) {
+            query[k] = dist(gen);
+        }
+
+        std::vector<float> loopDistances(n);
+        std::vector<float> batchDistances;
+        std::vector<FaceMatch> matches;
+        double loopTime = perPairLoop(query, pool, loopDistances);
+        double batchTime = batched(query, means, batchDistances);
+        double matchTime = batchedMatches(query, means, matches);
+
+        // the baseline ran over shuffled pointers, so compare against direct recomputation
+        float maxError = 0.0f;
+        for (int i = 0; i < n; i++) {
+            maxError = std::max(maxError, std::abs(batchDistances[i] - (float)l2Distance(query, means.get(i))));
+        }
+
+        fmt::println("{:>10} {:>14.1f} {:>14.1f} {:>14.1f} {:>9.1f}x {:>12.2e}", n, loopTime, batchTime, matchTime, loopTime / batchTime, maxError);
+    }
+
+    ThreadPool threads;
+    fmt::println("");
+    fmt::println("Pairwise distances on {} threads", threads.size());
+    fmt::println("{:>10} {:>14} {:>14} {:>10} {:>12}", "faces", "loop (s)", "blocked (s)", "speedup", "median");
+
+    for (int n : { 1000, 4000, 20000 }) {
+        std::vector<float> faces((size_t)n * FACE_VEC_SIZE);
+        for (float& value : faces) {
+            value = dist(gen);
+        }
+
+        // the loop is quadratic and slow, only run it where it finishes in seconds
+        DistanceHistogram loopHistogram;
+        double loopTime = 0.0;
+        if (n <= 4000) {
+            std::vector<std::vector<float>> nested(n);
+            for (int i = 0; i < n; i++) {
+                nested[i].assign(faces.begin() + (size_t)i * FACE_VEC_SIZE, faces.begin() + (size_t)(i + 1) * FACE_VEC_SIZE);
+            }
+            loopTime = pairwiseLoop(nested, loopHistogram);
+        }
+        DistanceHistogram blockedHistogram;
+        double blockedTime = pairwiseBlocked(faces, threads, blockedHistogram);
+
+        if (loopTime > 0.0) {
+            fmt::println("{:>10} {:>14.3f} {:>14.3f} {:>9.1f}x {:>12.2f}", n, loopTime, blockedTime, loopTime / blockedTime, blockedHistogram.quantile(0.5));
+        } else {
+            fmt::println("{:>10} {:>14} {:>14.3f} {:>10} {:>12.2f}", n, "-", blockedTime, "-", blockedHistogram.quantile(0.5));
+        }
+    }
+
+    return 0;
+}
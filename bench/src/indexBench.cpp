@@ -0,0 +1,138 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <fmt/core.h>
+
+#include <utils/EntityState.h>
+#include <utils/FaceIndex.h>
+
+// Recall vs latency of the HNSW face index against exact brute force.
+// The dataset faces are replicated with gaussian noise to reach each size.
+
+#define NOISE 0.3f
+#define QUERIES 200
+#define K 10
+
+typedef std::chrono::high_resolution_clock Clock;
+
+void loadFaces(std::string filename, std::vector<FFVec, Eigen::aligned_allocator<FFVec>>& faces) {
+    std::ifstream file(filename);
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        std::stringstream s(line);
+        std::string num;
+        FFVec face;
+        int feature = 0;
+        while (std::getline(s, num, ',') && feature < FACE_VEC_SIZE) {
+            face[feature++] = stof(num);
+        }
+        if (feature == FACE_VEC_SIZE) {
+            faces.push_back(face);
+        }
+    }
+}
+
+FFVec addNoise(const FFVec& face, std::mt19937& gen) {
+    std::normal_distribution<float> noise(0.0f, NOISE);
+    FFVec noisy = face;
+    for (int k = 0; k < FACE_VEC_SIZE; k++) {
+        noisy[k] += noise(gen);
+    }
+    return noisy;
+}
+
+int main(int argc, char* argv[]) {
+
+    std::string datasetPath = argc > 1 ? argv[1] : "../../../dataset.csv";
+    std::vector<FFVec, Eigen::aligned_allocator<FFVec>> faces;
+    loadFaces(datasetPath, faces);
+    if (faces.size() == 0) {
+        fmt::println("Failed to load faces from {}", datasetPath);
+        return 1;
+    }
+    fmt::println("Loaded {} faces from {}", faces.size(), datasetPath);
+
+    const float unbounded = std::numeric_limits<float>::max();
+
+    for (int n : { 1000, 10000, 50000 }) {
+        std::mt19937 gen(5678975);
+        std::vector<FFVec, Eigen::aligned_allocator<FFVec>> data;
+        for (int i = 0; i < n; i++) {
+            data.push_back(addNoise(faces[i % faces.size()], gen));
+        }
+        std::vector<FFVec, Eigen::aligned_allocator<FFVec>> queries;
+        for (int i = 0; i < QUERIES; i++) {
+            queries.push_back(addNoise(data[gen() % n], gen));
+        }
+
+        BruteForceFaceIndex exact;
+        HnswFaceIndex hnsw;
+
+        auto start = Clock::now();
+        for (int i = 0; i < n; i++) exact.insert(i, data[i]);
+        double exactBuild = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        start = Clock::now();
+        for (int i = 0; i < n; i++) hnsw.insert(i, data[i]);
+        double hnswBuild = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::vector<std::vector<FaceNeighbor>> truth(QUERIES);
+        start = Clock::now();
+        for (int q = 0; q < QUERIES; q++) {
+            exact.search(queries[q], K, unbounded, truth[q]);
+        }
+        double exactQuery = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / QUERIES;
+
+        fmt::println("\n{} faces, build exact {:.1f} ms, hnsw {:.1f} ms", n, exactBuild, hnswBuild);
+        fmt::println("{:>10} {:>12} {:>12}", "efSearch", "recall@10", "us/query");
+        fmt::println("{:>10} {:>12.3f} {:>12.1f}", "exact", 1.0, exactQuery);
+
+        for (int ef : { 10, 20, 40, 80, 160, 320 }) {
+            hnsw.setEfSearch(ef);
+            std::vector<FaceNeighbor> found;
+            int hits = 0;
+            double queryTime = 0.0;
+            for (int q = 0; q < QUERIES; q++) {
+                start = Clock::now();
+                hnsw.search(queries[q], K, unbounded, found);
+                queryTime += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                for (const FaceNeighbor& neighbor : found) {
+                    for (const FaceNeighbor& expected : truth[q]) {
+                        if (neighbor.id == expected.id) {
+                            hits++;
+                            break;
+                        }
+                    }
+                }
+            }
+            fmt::println("{:>10} {:>12.3f} {:>12.1f}", ef, hits / double(QUERIES * K), queryTime / QUERIES);
+        }
+
+        // move a tenth of the faces the way a nightly kalman update would and check recall holds
+        for (int i = 0; i < n; i += 10) {
+            data[i] = addNoise(data[i], gen);
+            exact.update(i, data[i]);
+            hnsw.update(i, data[i]);
+        }
+        hnsw.setEfSearch(80);
+        int hits = 0;
+        for (int q = 0; q < QUERIES; q++) {
+            std::vector<FaceNeighbor> expected, found;
+            exact.search(queries[q], K, unbounded, expected);
+            hnsw.search(queries[q], K, unbounded, found);
+            for (const FaceNeighbor& neighbor : found) {
+                hits += std::any_of(expected.begin(), expected.end(), [&](const FaceNeighbor& e) { return e.id == neighbor.id; });
+            }
+        }
+        fmt::println("{:>10} {:>12.3f} {:>12}", "updated", hits / double(QUERIES * K), "");
+    }
+
+    return 0;
+}
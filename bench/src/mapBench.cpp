@@ -0,0 +1,103 @@
+#include <vector>
+#include <set>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <fstream>
+
+#include <fmt/core.h>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <utils/Map.h>
+
+// Startup cost of map preprocessing (door path maps and device connections) on
+// map.xml and on a generated map tiling it TILES_X x TILES_Y times, serial
+// against the thread pool. The parallel results must match the serial ones.
+
+#define TILES_X 5
+#define TILES_Y 2
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Copies of the map side by side, ids are offset per tile so they stay dense
+void writeTiledMap(std::string mapPath, std::string tiledPath) {
+    boost::property_tree::ptree doc;
+    boost::property_tree::read_xml(mapPath, doc);
+    const boost::property_tree::ptree& map = doc.get_child("map");
+    float width = map.get<float>("<xmlattr>.width");
+    float height = map.get<float>("<xmlattr>.height");
+    int devCount = 0, doorCount = 0;
+    for (const auto& [name, child] : map) {
+        devCount += name == "device";
+        doorCount += name == "door";
+    }
+
+    std::ofstream out(tiledPath);
+    out << fmt::format("<?xml version=\"1.0\"?>\n<map width=\"{}\" height=\"{}\">\n", width * TILES_X, height * TILES_Y);
+    for (int tile = 0; tile < TILES_X * TILES_Y; tile++) {
+        float dx = width * (tile % TILES_X);
+        float dy = height * (tile / TILES_X);
+        for (const auto& [name, child] : map) {
+            if (name == "inBound" || name == "outBound") {
+                out << fmt::format("    <{} x=\"{}\" y=\"{}\" width=\"{}\" height=\"{}\"></{}>\n", name,
+                    child.get<float>("<xmlattr>.x") + dx, child.get<float>("<xmlattr>.y") + dy,
+                    child.get<float>("<xmlattr>.width"), child.get<float>("<xmlattr>.height"), name);
+            } else if (name == "device") {
+                out << fmt::format("    <device id=\"{}\" x=\"{}\" y=\"{}\" direction=\"{}\"></device>\n",
+                    child.get<int>("<xmlattr>.id") + tile * devCount, child.get<float>("<xmlattr>.x") + dx,
+                    child.get<float>("<xmlattr>.y") + dy, child.get<float>("<xmlattr>.direction"));
+            } else if (name == "door") {
+                out << fmt::format("    <door id=\"{}\" x=\"{}\" y=\"{}\" angle=\"{}\"></door>\n",
+                    child.get<int>("<xmlattr>.id") + tile * doorCount, child.get<float>("<xmlattr>.x") + dx,
+                    child.get<float>("<xmlattr>.y") + dy, child.get<float>("<xmlattr>.angle"));
+            }
+        }
+    }
+    out << "</map>\n";
+}
+
+struct Preprocessed {
+    std::vector<std::set<int>> matches;
+    std::vector<std::set<int>> conns;
+    Eigen::MatrixXd distances;
+    double pathMapsMs = 0.0;
+    double connectionsMs = 0.0;
+};
+
+Preprocessed preprocess(std::string mapPath, int threads) {
+    Map::setThreads(threads);
+    Map map(mapPath);
+    Preprocessed result;
+    auto start = Clock::now();
+    map.generatePathMaps(result.matches);
+    result.pathMapsMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    start = Clock::now();
+    map.getDeviceConnections(result.conns, result.distances);
+    result.connectionsMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+
+    std::string mapPath = argc > 1 ? argv[1] : "../../../map.xml";
+    std::string tiledPath = "tiledMap.xml";
+    writeTiledMap(mapPath, tiledPath);
+
+    int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::string path : { mapPath, tiledPath }) {
+        fmt::println("\n{}", path);
+        Preprocessed serial = preprocess(path, 1);
+        fmt::println("{:>10} {:>14} {:>16}", "threads", "path maps ms", "connections ms");
+        fmt::println("{:>10} {:>14.1f} {:>16.1f}", 1, serial.pathMapsMs, serial.connectionsMs);
+        for (int threads = 2; threads <= hardwareThreads; threads *= 2) {
+            Preprocessed parallel = preprocess(path, threads);
+            if (parallel.matches != serial.matches || parallel.conns != serial.conns || parallel.distances != serial.distances) {
+                fmt::println("Results with {} threads differ from the serial run", threads);
+                return 1;
+            }
+            fmt::println("{:>10} {:>14.1f} {:>16.1f}", threads, parallel.pathMapsMs, parallel.connectionsMs);
+        }
+    }
+
+    return 0;
+}
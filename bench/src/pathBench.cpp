@@ -0,0 +1,129 @@
+#include <vector>
+#include <set>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#include <fmt/core.h>
+
+#include <utils/PathGraph.h>
+
+// Walks every particle route of a large synthetic map, the way the lambda does
+// when computing particle times, over the CSR path graph and over the
+// std::set adjacency rows that getGraphEdges used to copy out per hop.
+
+#define GRID_SIZE 48
+#define EXTRA_EDGES 2
+#define PATHS 20000
+#define PATH_LENGTH 40
+#define ROUNDS 5
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Old getNext, copies the adjacency row each hop
+int setGetNext(const std::vector<std::set<int>>& conns, const PathGraph& path, int node) {
+    std::set<int> edges = conns[node];
+    int lowest = -1;
+    int lowestDepth = 0;
+    for (auto e = edges.begin(); e != edges.end(); e++) {
+        if (path.getDepth(*e) < lowestDepth) {
+            lowest = *e;
+            lowestDepth = path.getDepth(*e);
+        }
+    }
+    return lowest;
+}
+
+template<class Next>
+double walkRoutes(const std::vector<PathGraphPtr>& paths, const std::vector<int>& starts, int& hops, Next next) {
+    double length = 0.0;
+    hops = 0;
+    for (size_t p = 0; p < paths.size(); p++) {
+        int node = starts[p];
+        // routes can double back on themselves, so bound the walk like a timeout would
+        for (int step = 0; step < PATH_LENGTH * 2; step++) {
+            int nextNode = next(*paths[p], node);
+            if (nextNode == -1 || nextNode == node) break;
+            length += PathGraph::getGraphEdgeLength(node, nextNode);
+            node = nextNode;
+            hops++;
+        }
+    }
+    return length;
+}
+
+int main() {
+
+    // grid of devices with neighbour links plus a few random corridors
+    int nodeCount = GRID_SIZE * GRID_SIZE;
+    std::mt19937 gen(5678975);
+    std::uniform_int_distribution<int> anyNode(0, nodeCount - 1);
+    std::vector<std::set<int>> conns(nodeCount);
+    Eigen::MatrixXd distances = Eigen::MatrixXd::Zero(nodeCount, nodeCount);
+    auto link = [&](int a, int b) {
+        if (a == b) return;
+        conns[a].insert(b);
+        conns[b].insert(a);
+        double dx = a % GRID_SIZE - b % GRID_SIZE;
+        double dy = a / GRID_SIZE - b / GRID_SIZE;
+        distances(a, b) = distances(b, a) = std::sqrt(dx * dx + dy * dy);
+    };
+    for (int i = 0; i < nodeCount; i++) {
+        if (i % GRID_SIZE + 1 < GRID_SIZE) link(i, i + 1);
+        if (i + GRID_SIZE < nodeCount) link(i, i + GRID_SIZE);
+        for (int e = 0; e < EXTRA_EDGES; e++) link(i, anyNode(gen));
+    }
+
+    size_t edgeCount = 0;
+    for (const std::set<int>& nodeConns : conns) edgeCount += nodeConns.size();
+
+    auto start = Clock::now();
+    PathGraph::initGraph(conns, distances);
+    double build = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    fmt::println("{} nodes, {} edges, csr built in {:.1f} ms", PathGraph::getNodeCount(), edgeCount, build);
+
+    // particle routes are random walks recorded the way the lambda records them
+    std::vector<PathGraphPtr> paths;
+    std::vector<int> starts;
+    for (int p = 0; p < PATHS; p++) {
+        // start() logs, so seed the first depth through the blob constructor
+        std::vector<int> depths(nodeCount, 0);
+        int node = anyNode(gen);
+        starts.push_back(node);
+        depths[node] = -1;
+        PathGraphPtr path(new PathGraph(p, -1, 1, boost::span<const UCHAR>(reinterpret_cast<const UCHAR*>(depths.data()), depths.size() * sizeof(int))));
+        for (int step = 0; step < PATH_LENGTH; step++) {
+            boost::span<const int32_t> edges = PathGraph::getGraphEdges(node);
+            int nextNode = edges[gen() % edges.size()];
+            path->update(node, nextNode);
+            node = nextNode;
+        }
+        paths.push_back(path);
+    }
+
+    double setTime = 0.0, csrTime = 0.0;
+    double setLength = 0.0, csrLength = 0.0;
+    int setHops = 0, csrHops = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        start = Clock::now();
+        setLength = walkRoutes(paths, starts, setHops, [&](const PathGraph& path, int node) { return setGetNext(conns, path, node); });
+        setTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        csrLength = walkRoutes(paths, starts, csrHops, [](const PathGraph& path, int node) { return path.getNext(node); });
+        csrTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    if (setHops != csrHops || setLength != csrLength) {
+        fmt::println("Routes differ: set {} hops {:.1f} long, csr {} hops {:.1f} long", setHops, setLength, csrHops, csrLength);
+        return 1;
+    }
+
+    fmt::println("{} routes, {} hops, {:.1f} total length", PATHS, csrHops, csrLength);
+    fmt::println("{:>10} {:>12} {:>12}", "graph", "ms/walk", "ns/hop");
+    fmt::println("{:>10} {:>12.2f} {:>12.1f}", "set", setTime / ROUNDS, setTime * 1e6 / ROUNDS / setHops);
+    fmt::println("{:>10} {:>12.2f} {:>12.1f}", "csr", csrTime / ROUNDS, csrTime * 1e6 / ROUNDS / csrHops);
+
+    return 0;
+}
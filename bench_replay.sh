@@ -0,0 +1,21 @@
+#!/bin/bash
+# Replays a recorded trace through falambda at 1..N threads and prints an updates/s table.
+# The test database is restored from a dump before each run so every thread count starts from the same state.
+# usage: ./bench_replay.sh trace.bin [max threads]
+set -e
+TRACE=$1
+MAX=${2:-$(nproc)}
+DUMP=$(mktemp)
+mysqldump -u root test > "$DUMP"
+echo "| threads | updates/s | p50 ms | p99 ms |"
+echo "|---|---|---|---|"
+for ((t = 1; t <= MAX; t++)); do
+    mysql -u root test < "$DUMP"
+    OUT=$(./lambda/build/falambda --replay "$TRACE" --replay-speed 0 --threads $t)
+    RATE=$(echo "$OUT" | sed -n 's/^Replayed .*(\([0-9.]*\) updates\/s).*/\1/p')
+    P50=$(echo "$OUT" | sed -n 's/^Latency ms: p50 \([0-9.]*\),.*/\1/p')
+    P99=$(echo "$OUT" | sed -n 's/.* p99 \([0-9.]*\),.*/\1/p')
+    echo "| $t | $RATE | $P50 | $P99 |"
+done
+mysql -u root test < "$DUMP"
+rm "$DUMP"
@@ -5,40 +5,73 @@
 #include <algorithm>
 #include <string>
 #include <fstream>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <set>
+#include <unordered_set>
 
 #include <fmt/core.h>
-#include <Eigen/dense>
+#include <Eigen/Dense>
 
 #include <utils/DBConnection.h>
+#include <utils/DBConnectionPool.h>
 #include <utils/EntityState.h>
 #include <utils/PathGraph.h>
+#include <utils/StateCache.h>
+#include <utils/FaceDistance.h>
+#include <utils/FaceIndex.h>
+#include <utils/ThreadPool.h>
+#include <utils/UnitOfWork.h>
+#include <utils/Ingest.h>
+#include <utils/Trace.h>
 
 #define MATCHING_THRESH 140.0
+#define STATE_LOCK_SHARDS 64
+// Longest the lambda sleeps on the ingest queue before checking the updates table itself
+#define INGEST_POLL_MS 1000
+#define INGEST_BATCH 256
+#define RECENT_UPDATES 4096
 
 DBConnection db;
+StateCache cache;
 
-FFMat R = FFMat::Zero();
+// Updates matching the same sts serialize on its shard, everything else runs in parallel
+std::mutex stateLocks[STATE_LOCK_SHARDS];
+int stateShard(int stsId) { return stsId % STATE_LOCK_SHARDS; }
+// Held by an update from its empty match until the sts it creates is in the cache
+std::mutex createMutex;
+
+FFCov R = FFCov::Zero();
 double speed = 10.0;
 
-void computeParticleTimes(Particle particle, PathGraphPtr path) {
+bool computeParticleTimes(UnitOfWork& work, Particle particle, PathGraphPtr path) {
     fmt::println("Computing particle times for particle {}", particle.id);
-    std::chrono::time_point startTime = db.getTime();
+    TimePoint startTime;
+    if (!work.db().getTime(startTime)) {
+        return false;
+    }
     int node = particle.originDeviceId;
     int nextNode = path->getNext(node);
     while (nextNode != -1 && nextNode != node) {
         double distance = PathGraph::getGraphEdgeLength(node, nextNode);
-        db.addParticleTime(particle, nextNode, startTime + std::chrono::milliseconds(int((distance / speed) * 1000)));
+        work.addParticleTime(particle, nextNode, startTime + std::chrono::milliseconds(int((distance / speed) * 1000)));
         node = nextNode;
         nextNode = path->getNext(node);
     }
+    return true;
 }
 
-void getFacialMatches(UpdatePtr update, const std::vector<ShortTermStatePtr>& pool, std::vector<ShortTermStatePtr>& matches, std::vector<double>& matchDistances) {
+void getFacialMatches(UpdatePtr update, const std::vector<ShortTermStatePtr>& pool, const FaceMatrix& poolMeans, std::vector<ShortTermStatePtr>& matches, std::vector<double>& matchDistances) {
 
     try {
-        for (const ShortTermStatePtr &cmp : pool) {
+        std::vector<float> distances;
+        batchL2Distance(update->facialFeatures, poolMeans, distances);
+        for (int i = 0; i < pool.size(); i++) {
+            const ShortTermStatePtr& cmp = pool[i];
 
-            double distance = l2Distance(update->facialFeatures, cmp->facialFeatures);
+            double distance = distances[i];
             
             // Bhattacharyya distance
             //std::unique_ptr<FFVec> diff = std::unique_ptr<FFVec>(new FFVec());
@@ -64,89 +97,81 @@ void getFacialMatches(UpdatePtr update, const std::vector<ShortTermStatePtr>& po
     }
 }
 
-LongTermStatePtr getFacialMatch(ShortTermStatePtr sts, const std::vector<LongTermStatePtr>& pool) {
+LongTermStatePtr getFacialMatch(ShortTermStatePtr sts, const StateCache& cache) {
     try {
-        double smallestDistance = -1;
-        LongTermStatePtr closest = nullptr;
-        for (const LongTermStatePtr &cmp : pool) {
-
-            double distance = l2Distance(sts->facialFeatures, cmp->facialFeatures);
-            
-            fmt::println("Matching sts {} to lts {} with distance {}", sts->id, cmp->id, distance);
-            if (std::isnan(distance)) {
-                throw std::runtime_error("NaN distance");
-            }
-            if (distance == 0) {
-                throw std::runtime_error("0 distance");
-            }
+        std::vector<FaceNeighbor> nearest;
+        cache.getLongTermIndex().search(sts->facialFeatures, 1, MATCHING_THRESH, nearest);
+        if (nearest.size() == 0) {
+            return nullptr;
+        }
 
-            if (distance < smallestDistance || smallestDistance == -1) {
-                smallestDistance = distance;
-                closest = cmp;
-            }
+        double distance = nearest[0].distance;
+        fmt::println("Matching sts {} to lts {} with distance {}", sts->id, nearest[0].id, distance);
+        if (std::isnan(distance)) {
+            throw std::runtime_error("NaN distance");
         }
-        if (smallestDistance < MATCHING_THRESH) {
-            return closest;
+        if (distance == 0) {
+            throw std::runtime_error("0 distance");
         }
+        return cache.getLongTermState(nearest[0].id);
     } catch (std::exception& e) {
         fmt::println("main:getFacialMatch Error - {}", e.what());
     }
     return nullptr;
 }
 
-void processUpdate(UpdatePtr update) {
-
-    fmt::print("Proccessing update {} from device {}\n", update->id, update->deviceId);
-
-    update->facialFeaturesCov = R;
-    int period = db.getPeriod();
-
-    std::vector<ShortTermStatePtr> shortTermStates;
-    db.getShortTermStates(shortTermStates);
+// Applies an update to the states it matched in one unit of work. Each matched state
+// is copied to previous before it changes, the caller reverts them if this fails.
+bool applyUpdate(DBConnection& db, UpdatePtr update, int period, const std::vector<ShortTermStatePtr>& matches,
+    const std::vector<double>& matchDistances, std::vector<ShortTermState>& previous) {
 
-    std::vector<LongTermStatePtr> longTermStates;
-    db.getLongTermStates(longTermStates);
-
-    std::vector<ShortTermStatePtr> matches;
-    std::vector<double> matchDistances;
-    // TODO
-    // match against who is probably there
-    // match against who could be there
-
-    // match against people seen
-    getFacialMatches(update, shortTermStates, matches, matchDistances);
+    UnitOfWork work(db);
+    if (!work.begin()) {
+        return false;
+    }
 
     fmt::println("Found {} matches in short term states", matches.size());
     for (int i = 0; i < matches.size(); i++) { 
         ShortTermStatePtr match = matches[i];
+        previous.push_back(*match);
 
         //if matched to short term, apply update
+        // a failed read mid transaction isn't retried on a new connection, roll back instead
         PathGraphPtr path = db.getPath(match, period);
+        if (path == nullptr) {
+            return false;
+        }
         if (match->lastUpdateDeviceId != -1) {
             path->update(match->lastUpdateDeviceId, update->deviceId);
         }
-        db.updatePath(path);
+        work.updatePath(path);
 
         match->lastUpdateDeviceId = update->deviceId;
         match->kalmanUpdate(update);
 
         fmt::println("Rematching sts {} to long term states", match->id);
-        LongTermStatePtr ltMatch = getFacialMatch(match, longTermStates);
+        LongTermStatePtr ltMatch;
+        {
+            auto cacheLock = cache.readLock();
+            ltMatch = getFacialMatch(match, cache);
+        }
         if (ltMatch != nullptr) {
             match->longTermStateKey = ltMatch->id;
         }
 
-        // update->shortTermStateId = match->id;
+        if (update->shortTermStateId == -1) {
+            update->shortTermStateId = match->id;
+        }
         match->updateCount++;
-        db.updateShortTermState(match);
+        cache.commitShortTermState(work, match);
 
         double weight = 1 - (matchDistances[i] / MATCHING_THRESH); // 0 to 1
         Particle particle = db.createParticle(match->id, update, weight);
 
         if (match->longTermStateKey != -1) {
             PathGraphPtr ltsPath = db.getLtsPath(match->longTermStateKey, period);
-            if (ltsPath) {
-                computeParticleTimes(particle, ltsPath);
+            if (ltsPath && !computeParticleTimes(work, particle, ltsPath)) {
+                return false;
             }
         }
 
@@ -173,50 +198,279 @@ void processUpdate(UpdatePtr update) {
     //     }
     // }
 
+    // a new sts only joins the cache once its rows are committed
+    ShortTermStatePtr newSts;
     if (matches.size() == 0) {
         fmt::print("No match found\n");
-        ShortTermStatePtr sts = db.createShortTermState(update);
-        Particle particle = db.createParticle(sts->id, update, 1.0);
+        newSts = db.createShortTermState(update);
+        if (newSts == nullptr) {
+            return false;
+        }
+        update->shortTermStateId = newSts->id;
+        Particle particle = db.createParticle(newSts->id, update, 1.0);
 
-        LongTermStatePtr ltMatch = getFacialMatch(sts, longTermStates);
+        LongTermStatePtr ltMatch;
+        {
+            auto cacheLock = cache.readLock();
+            ltMatch = getFacialMatch(newSts, cache);
+        }
         if (ltMatch != nullptr) {
-            sts->longTermStateKey = ltMatch->id;
-            PathGraphPtr ltsPath = db.getLtsPath(sts->longTermStateKey, period);
-            if (ltsPath) {
-                computeParticleTimes(particle, ltsPath);
+            newSts->longTermStateKey = ltMatch->id;
+            PathGraphPtr ltsPath = db.getLtsPath(newSts->longTermStateKey, period);
+            if (ltsPath && !computeParticleTimes(work, particle, ltsPath)) {
+                return false;
             }
         }
-        db.updateShortTermState(sts);
+        cache.commitShortTermState(work, newSts);
 
-        PathGraphPtr path = db.getPath(sts, period);
+        PathGraphPtr path = db.getPath(newSts, period);
+        if (path == nullptr) {
+            return false;
+        }
         path->start(update->deviceId);
-        db.updatePath(path);
+        work.updatePath(path);
     }
 
-    db.removeUpdate(update);
+    // the updates table is kept as a log, so mark the row handled instead of deleting it
+    work.markUpdate(update);
     // db.removePreviousUpdates(update);
-    // db.updateUpdate(update);
+
+    if (!work.commit()) {
+        return false;
+    }
+    if (newSts != nullptr) {
+        cache.addShortTermState(newSts);
+    }
+    return true;
 }
 
-int main() {
+bool processUpdate(DBConnection& db, UpdatePtr update) {
+
+    fmt::print("Proccessing update {} from device {}\n", update->id, update->deviceId);
+
+    update->facialFeaturesCov = R;
+    int period, epoch;
+    // syncing to a made up epoch would throw the cache away over a connection that's failing
+    if (!db.getGlobals(period, epoch)) {
+        return false;
+    }
+    cache.sync(db, epoch);
+
+    std::vector<ShortTermStatePtr> matches;
+    std::vector<double> matchDistances;
+    // TODO
+    // match against who is probably there
+    // match against who could be there
+
+    // match against people seen
+    // Matched states stay locked until the unit of work commits, so the next update to
+    // touch them reads what this one wrote. Shards are taken in order to avoid deadlock.
+    // The match is redone once the locks are held and only kept if it still falls in
+    // those shards, so the means and distances used below can't change under it. An
+    // update matching nothing holds createMutex instead until its new sts is cached,
+    // which keeps two sightings of a new face from each creating a state.
+    std::set<int> shards;
+    std::vector<std::unique_lock<std::mutex>> locks;
+    std::unique_lock<std::mutex> createLock(createMutex, std::defer_lock);
+    bool locked = false;
+    while (true) {
+        matches.clear();
+        matchDistances.clear();
+        {
+            auto lock = cache.readLock();
+            getFacialMatches(update, cache.getShortTermStates(), cache.getShortTermMeans(), matches, matchDistances);
+        }
+        std::set<int> matchShards;
+        for (ShortTermStatePtr& match : matches) {
+            matchShards.insert(stateShard(match->id));
+        }
+        if (locked) {
+            bool held = matches.size() > 0 ? std::includes(shards.begin(), shards.end(), matchShards.begin(), matchShards.end()) : createLock.owns_lock();
+            if (held) break;
+            locks.clear();
+            if (createLock.owns_lock()) createLock.unlock();
+        }
+        shards = matchShards;
+        if (shards.empty()) {
+            createLock.lock();
+        }
+        for (int shard : shards) {
+            locks.emplace_back(stateLocks[shard]);
+        }
+        locked = true;
+    }
+
+    // copies to put back if the update fails, while the states are still locked so no
+    // other update sees the rolled back values
+    std::vector<ShortTermState> previous;
+    bool applied = false;
+    try {
+        applied = applyUpdate(db, update, period, matches, matchDistances, previous);
+    }
+    catch (const std::exception& e) {
+        fmt::println("main:processUpdate Error - update {} failed: {}", update->id, e.what());
+    }
+    if (!applied) {
+        for (int i = 0; i < previous.size(); i++) {
+            cache.revertShortTermState(matches[i], previous[i]);
+        }
+    }
+    return applied;
+}
+
+int main(int argc, char* argv[]) {
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool dbStats = false;
+    std::string replayPath;
+    double replaySpeed = 1.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        }
+        if (arg == "--index" && i + 1 < argc) {
+            std::string type = argv[++i];
+            cache.setIndexType(type == "hnsw" ? HNSW_INDEX : BRUTE_FORCE_INDEX);
+            fmt::println("Using {} long term state index", type == "hnsw" ? "hnsw" : "brute force");
+        }
+        if (arg == "--db-stats") {
+            dbStats = true;
+        }
+        // feeds a fasim trace through the pipeline instead of live detections, then exits
+        if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        // multiple of the recorded pace, 0 replays as fast as updates are taken
+        if (arg == "--replay-speed" && i + 1 < argc) {
+            replaySpeed = std::stod(argv[++i]);
+        }
+    }
 
     loadUpdateCov("../../../updateCov.csv", R);
 
     db.connect();
     //db.createTables();
 
-    PathGraph::initGraph("../../../map.xml", "pathGraph.csv");
+    Map::setThreads(threads);
+    PathGraph::initGraph("../../../map.xml", "pathGraph.bin");
+
+    fmt::println("Starting {} workers", threads);
+    ThreadPool pool(threads);
+    DBConnectionPool dbPool(threads);
+    dbPool.connect();
+
+    UpdateQueue queue;
+    IngestServer ingest(queue);
+    std::unique_ptr<TraceReplay> replay;
+    if (replayPath.empty()) {
+        ingest.start();
+    } else {
+        replay = std::unique_ptr<TraceReplay>(new TraceReplay(replayPath, queue, replaySpeed));
+        if (!replay->start()) {
+            return 1;
+        }
+    }
+
+    // Updates can arrive both pushed and from the fallback poll, remember recent ids to
+    // process each once
+    std::unordered_set<int> recentIds;
+    std::deque<int> recentOrder;
 
     std::vector<UpdatePtr> updates;
+    std::vector<UpdatePtr> batch;
+    std::mutex failedMutex;
+    std::vector<int> failed;
+    // queue to processed time of each replayed update
+    std::vector<double> latencies;
+    auto replayStart = std::chrono::steady_clock::now();
     printf("Checking for new updates... \n");
-    while (1) {
+    // pick up anything logged while the lambda was down
+    if (!replay) {
         db.getNewUpdates(updates);
-        if (updates.size() == 0) continue;
-        fmt::print("Got {} new updates\n", updates.size());
-        for (auto i = updates.begin(); i != updates.end(); i++) {
-            processUpdate(*i);
+    }
+    // updates the ingest server dropped on a full queue are only in the table, and a
+    // busy queue never idles long enough for the poll, so poll on a timer until they're fetched
+    bool dropsPending = false;
+    auto lastPoll = std::chrono::steady_clock::now();
+    while (1) {
+        if (updates.size() == 0 && queue.pop(updates, INGEST_BATCH, std::chrono::milliseconds(INGEST_POLL_MS)) == 0) {
+            if (!replay) {
+                // anything dropped so far is in the table this reads
+                queue.takeDropped();
+                dropsPending = false;
+                db.getNewUpdates(updates);
+                lastPoll = std::chrono::steady_clock::now();
+            } else if (replay->done() && queue.size() == 0) {
+                break;
+            }
+        }
+        if (!replay) {
+            if (queue.takeDropped() > 0) dropsPending = true;
+            auto now = std::chrono::steady_clock::now();
+            if (dropsPending && now - lastPoll >= std::chrono::milliseconds(INGEST_POLL_MS)) {
+                // taken before the query, so everything it counted is already in the table
+                dropsPending = false;
+                db.getNewUpdates(updates);
+                lastPoll = now;
+            }
+        }
+        for (UpdatePtr& update : updates) {
+            if (!recentIds.insert(update->id).second) continue;
+            recentOrder.push_back(update->id);
+            if (recentOrder.size() > RECENT_UPDATES) {
+                recentIds.erase(recentOrder.front());
+                recentOrder.pop_front();
+            }
+            batch.push_back(update);
         }
         updates.clear();
+        if (batch.size() == 0) continue;
+        fmt::print("Got {} new updates\n", batch.size());
+        auto start = std::chrono::steady_clock::now();
+        for (UpdatePtr& update : batch) {
+            pool.submit([update, &dbPool, &failedMutex, &failed, &replay, &latencies] {
+                bool processed = false;
+                // the pool would swallow anything thrown and the update would be lost, count it as failed to retry
+                try {
+                    DBConnectionPool::Lease conn = dbPool.lease();
+                    processed = processUpdate(*conn, update);
+                }
+                catch (const std::exception& e) {
+                    fmt::println("main: update {} failed: {}", update->id, e.what());
+                }
+                std::lock_guard<std::mutex> lock(failedMutex);
+                if (!processed) {
+                    failed.push_back(update->id);
+                } else if (replay) {
+                    latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replay->queuedAt(update->id)).count());
+                }
+            });
+        }
+        pool.wait();
+        // rolled back updates are still unmarked in the log, let the next poll retry them
+        for (int id : failed) {
+            recentIds.erase(id);
+        }
+        failed.clear();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::println("Processed {} updates in {:.1f} ms ({:.1f} updates/s) on {} threads", batch.size(), seconds * 1000, batch.size() / seconds, threads);
+        if (dbStats) {
+            std::vector<StatementStats> stats;
+            db.getStatementStats(stats);
+            dbPool.getStatementStats(stats);
+            DBConnection::printStatementStats(stats);
+        }
+        batch.clear();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+    fmt::println("Replayed {} of {} detections in {:.1f} s ({:.1f} updates/s), {} failed",
+        latencies.size(), replay->size(), seconds, latencies.size() / seconds, replay->size() - latencies.size());
+    if (latencies.size() > 0) {
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))]; };
+        fmt::println("Latency ms: p50 {:.1f}, p95 {:.1f}, p99 {:.1f}, max {:.1f}", percentile(0.5), percentile(0.95), percentile(0.99), latencies.back());
     }
     
     return 0;
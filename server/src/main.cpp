@@ -28,7 +28,7 @@ int matchStudent(ShortTermStatePtr sts) {
     std::vector<Schedule> possible = schedules;
 
     for (int per = 0; per < devPath.size(); per++) {
-        std::set<int> doors = devDoorsMatches[devPath[per]];
+        const std::set<int>& doors = devDoorsMatches[devPath[per]];
         for (std::vector<Schedule>::iterator i = possible.begin(); i != possible.end();) {
             if (doors.find(i->rooms[per]) == doors.end()) {
                 i = possible.erase(i);
@@ -134,28 +134,35 @@ void nextDay() {
     db.clearParticles();
     db.clearStsPaths();
     db.clearShortTermStates();
+    db.bumpStateEpoch();
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 
-    PathGraph::initGraph("../../../map.xml", "pathGraph.csv");
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            Map::setThreads(std::stoi(argv[++i]));
+        }
+    }
+
+    PathGraph::initGraph("../../../map.xml", "pathGraph.bin");
 
     db.connect();
     // db.createTables();
     // db.initGlobals();
 
-    printf("Loading map ... ");
     Map map("../../../map.xml");
-    printf("Done\nMatching doors and devices ... ");
-    std::vector<std::set<int>> doorDevsMatches;
-    map.generatePathMaps(doorDevsMatches);
+    // door matches come from the path map store, only built when the map changes
+    map.loadPathMaps("pathMaps.bin");
+    const std::vector<std::set<int>>& doorDevsMatches = map.getDoorMatches();
 
     // flip matches
     for (int i = 0; i < map.devs.size(); i++) {
         int dev = map.devs[i].id;
         std::set<int> doors;
         for (int door = 0; door < doorDevsMatches.size(); door++) {
-            std::set<int> devs = doorDevsMatches[door];
+            const std::set<int>& devs = doorDevsMatches[door];
             if (devs.find(dev) != devs.end()) {
                 doors.insert(door);
             }
@@ -163,8 +170,6 @@ int main() {
         devDoorsMatches.push_back(doors);
     }
 
-    printf("Done\n");
-
     db.getSchedules(schedules);
 
     printf("Ready\n");
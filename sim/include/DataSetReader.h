@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <utils/EntityState.h>
+#include <utils/MappedFile.h>
+
+// Reads a dataset csv: a header line "entities, images", then images rows of
+// FACE_VEC_SIZE comma separated floats for each entity. The file is mapped and
+// parsed in place with std::from_chars.
+class DataSetReader {
+public:
+
+	DataSetReader(const std::string& path);
+
+	// False if the file can't be mapped or has no header
+	bool valid() const { return _valid; }
+	int entities() const { return _entities; }
+	int images() const { return _images; }
+
+	// Appends the next entity's images * FACE_VEC_SIZE features, false at the end of
+	// the file. Throws std::runtime_error on a malformed row or a partial entity.
+	bool next(std::vector<float>& features);
+
+private:
+
+	// Parses one line of comma separated numbers into values, returns how many
+	// there were (storing at most max) or -1 at the end of the file. Blank lines
+	// are skipped.
+	template<class T>
+	int parseRow(T* values, int max);
+
+	MappedFile _file;
+	const char* _cursor = nullptr;
+	const char* _end = nullptr;
+	bool _valid = false;
+	int _entities = 0;
+	int _images = 0;
+
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include <utils/EntityState.h>
+#include <utils/DBConnection.h>
+#include <utils/Ingest.h>
+
+// Detections waiting to be logged, enough for a few seconds of a busy crowd
+#define PUBLISH_QUEUE_CAPACITY 65536
+
+// Logs detections to the updates table from a background thread with its own
+// connection, so the simulation tick never waits on the db. Queued detections
+// are written in multi-row batches as they fill or age.
+class DetectionPublisher {
+public:
+
+	DetectionPublisher(size_t capacity = PUBLISH_QUEUE_CAPACITY);
+	~DetectionPublisher();
+
+	bool start();
+	// Writes everything already queued, then stops the writer
+	void stop();
+
+	// Never blocks, detections that don't fit in the queue are dropped and counted
+	void publish(const std::vector<UpdatePtr>& detections);
+	long long dropped() const { return _dropped; }
+
+private:
+
+	void write();
+
+	UpdateQueue _queue;
+	DBConnection _db;
+	std::thread _thread;
+	std::atomic<bool> _stopping{ false };
+	std::atomic<long long> _dropped{ 0 };
+
+};
@@ -6,8 +6,11 @@
 #include <glm/glm.hpp>
 
 #include <utils/EntityState.h>
-#include <utils/DBConnection.h>
 #include <utils/Map.h>
+#include <utils/Crowd.h>
+
+#include "EntityGrid.h"
+#include "FeatureTable.h"
 
 class Device : public DeviceView {
     
@@ -15,12 +18,23 @@ public:
 
 	Device(DeviceView view);
 
-	void run(const std::vector<EntityPtr> &entites);
+	// Updates which entities are in view, entered gets the indices of those that
+	// just came into view. Only touches this device, so devices can look in parallel.
+	void look(const EntityGrid& grid, const Crowd& crowd, const std::vector<EntityPtr>& entities, std::vector<int>& entered);
+	// Appends a detection for each entered entity the table has features for, for the simulation to publish
+	void detect(const FeatureTable& features, const std::vector<EntityPtr>& entities, const std::vector<int>& entered, std::vector<UpdatePtr>& detections);
 
 private:
 
-	DBConnection _db;
+	// Cheap tests that never reject a point the view contains
+	bool mightSee(glm::vec2 point) const;
 
 	std::set<int> _seenEntities;
+	std::vector<int> _near;
+
+	Rect2d _viewBox;
+	// unit vector down the middle of the view
+	glm::vec2 _facing;
+	float _cosHalfAngle;
 
 };
\ No newline at end of file
@@ -9,7 +9,8 @@
 
 #include <utils/Map.h>
 #include <utils/EntityState.h>
-#include <utils/DBConnection.h>
+#include <utils/Crowd.h>
+#include <utils/DBConnectionPool.h>
 
 #include "Device.h"
 
@@ -22,9 +23,11 @@ public:
 
 	bool isRunning() { return getNumWindows() > 0; }
 
-	void setObservables(const Map* map, const std::vector<EntityPtr>* entities) {
+	void setObservables(const Map* map, const std::vector<EntityPtr>* entities, const Crowd* crowd, DBConnectionPool* dbPool) {
 		_map = map;
 		_entities = entities;
+		_crowd = crowd;
+		_dbPool = dbPool;
 	}
 
 	void setup() override;
@@ -37,8 +40,9 @@ private:
 
 	const Map* _map = nullptr;
 	const std::vector<EntityPtr>* _entities = nullptr;
+	const Crowd* _crowd = nullptr;
 
-	DBConnection _db;
+	DBConnectionPool* _dbPool = nullptr;
 	std::vector<ShortTermStatePtr> _shortTermStates;
 	std::vector<Particle> _particles;
 	PathGraphPtr _pathGraph;
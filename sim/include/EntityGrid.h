@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <utils/Crowd.h>
+#include <utils/Shape2d.h>
+
+// Uniform grid of entity positions, rebuilt every tick so devices only test
+// the entities near them
+class EntityGrid {
+public:
+
+	EntityGrid() {}
+	EntityGrid(glm::vec2 size, float cellSize);
+
+	void build(const Crowd& crowd);
+
+	// Indices of the entities in the cells overlapping box, ascending
+	void near(const Rect2d& box, std::vector<int>& found) const;
+
+private:
+
+	int cellOf(int x, int y) const { return x * _rows + y; }
+	int column(float x) const;
+	int row(float y) const;
+
+	float _cellSize = 1.0;
+	int _columns = 0;
+	int _rows = 0;
+	// entities bucketed by cell, cell c holds _entries[_cellStart[c] .. _cellStart[c + 1])
+	std::vector<int> _cellStart;
+	std::vector<int> _entries;
+	std::vector<int> _entityCells;
+
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <boost/core/span.hpp>
+
+#include <utils/EntityState.h>
+#include <utils/DBConnection.h>
+
+// Every student's facial features as seen by each device, loaded once so
+// devices look them up during a tick instead of querying facial_data
+class FeatureTable {
+public:
+
+	FeatureTable() {}
+
+	void load(DBConnection& db);
+
+	int size() const { return _index.size(); }
+	// Empty when the student has no features for the device
+	boost::span<const UCHAR> find(int studentId, int deviceId) const;
+
+private:
+
+	static uint64_t key(int studentId, int deviceId) { return ((uint64_t)(uint32_t)studentId << 32) | (uint32_t)deviceId; }
+
+	// row of each (student, device), rows are FACE_VEC_SIZE floats in _features
+	std::unordered_map<uint64_t, int> _index;
+	std::vector<float> _features;
+
+};
@@ -1,31 +1,60 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 
 #include <utils/Map.h>
 #include <utils/DBConnection.h>
+#include <utils/DBConnectionPool.h>
 #include <utils/EntityState.h>
+#include <utils/Crowd.h>
+#include <utils/ThreadPool.h>
+#include <utils/FaceDistance.h>
+#include <utils/Trace.h>
 
 #include "Device.h"
+#include "FeatureTable.h"
+#include "DetectionPublisher.h"
+#include "DataSetReader.h"
+#ifndef SIM_HEADLESS
 #include "Display.h"
+#endif
 
 class Simulation {
 public:
 
-	Simulation();
+	// timeScale is simulated seconds per wall second, <= 0 runs as fast as possible.
+	// Headless runs without the display, SIM_HEADLESS builds always are.
+	Simulation(int threads = 0, float timeScale = 1.0, bool headless = false);
+
+	// Records every detection pushed from now on to a trace at path
+	bool record(const std::string& path);
 
 	void run();
 
 private:
 
 	DBConnection _db;
+	// used by the display
+	DBConnectionPool _dbPool;
+	ThreadPool _pool;
+	float _timeScale;
+	std::unique_ptr<TraceWriter> _trace;
+	FeatureTable _features;
+	DetectionPublisher _publisher;
 
 	Map _map;
-	Display* _display;
+#ifndef SIM_HEADLESS
+	Display* _display = nullptr;
+#endif
 	std::vector<Device*> _devices;
 	std::vector<EntityPtr> _entities;
+	// positions and headings of _entities, same order
+	Crowd _crowd;
 
 	void uploadDataSet(std::string filename, int max = -1, bool startingData = false);
+	// Histograms of the squared distances between images of the same and of different entities
+	void writeDistances(const std::vector<float>& faces, int imgs, const std::string& path);
 	void getSchedules();
 
 };
\ No newline at end of file
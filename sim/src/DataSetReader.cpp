@@ -0,0 +1,60 @@
+
+#include <charconv>
+#include <stdexcept>
+
+#include "DataSetReader.h"
+
+DataSetReader::DataSetReader(const std::string& path) : _file(path) {
+	if (!_file.valid()) return;
+	_cursor = _file.data();
+	_end = _cursor + _file.size();
+	int header[2];
+	if (parseRow(header, 2) != 2) return;
+	_entities = header[0];
+	_images = header[1];
+	_valid = _images > 0;
+}
+
+template<class T>
+int DataSetReader::parseRow(T* values, int max) {
+	while (_cursor < _end && (*_cursor == '\n' || *_cursor == '\r')) _cursor++;
+	if (_cursor == _end) return -1;
+	int count = 0;
+	while (_cursor < _end && *_cursor != '\n' && *_cursor != '\r') {
+		while (_cursor < _end && *_cursor == ' ') _cursor++;
+		T value;
+		std::from_chars_result parsed = std::from_chars(_cursor, _end, value);
+		if (parsed.ec != std::errc()) {
+			throw std::runtime_error("malformed number\n");
+		}
+		// extra values are counted but not stored, the caller checks the count
+		if (count < max) {
+			values[count] = value;
+		}
+		count++;
+		_cursor = parsed.ptr;
+		while (_cursor < _end && *_cursor == ' ') _cursor++;
+		if (_cursor < _end && *_cursor == ',') _cursor++;
+	}
+	return count;
+}
+
+bool DataSetReader::next(std::vector<float>& features) {
+	if (!_valid) return false;
+	size_t start = features.size();
+	for (int img = 0; img < _images; img++) {
+		features.resize(start + (size_t)(img + 1) * FACE_VEC_SIZE);
+		int count = parseRow(features.data() + start + (size_t)img * FACE_VEC_SIZE, FACE_VEC_SIZE);
+		if (count == -1 && img == 0) {
+			features.resize(start);
+			return false;
+		}
+		if (count == -1) {
+			throw std::runtime_error("inproper alignment\n");
+		}
+		if (count != FACE_VEC_SIZE) {
+			throw std::runtime_error("improper feature vector dimensions\n");
+		}
+	}
+	return true;
+}
@@ -0,0 +1,50 @@
+
+#include <fmt/core.h>
+
+#include "DetectionPublisher.h"
+
+DetectionPublisher::DetectionPublisher(size_t capacity) : _queue(capacity) {}
+
+DetectionPublisher::~DetectionPublisher() {
+	stop();
+}
+
+bool DetectionPublisher::start() {
+	if (_thread.joinable()) return true;
+	// a failed connect is retried, with backoff, on the first write
+	bool connected = _db.connect();
+	_stopping = false;
+	_thread = std::thread(&DetectionPublisher::write, this);
+	return connected;
+}
+
+void DetectionPublisher::stop() {
+	if (!_thread.joinable()) return;
+	_stopping = true;
+	_thread.join();
+	if (_dropped > 0) {
+		fmt::println("DetectionPublisher - Dropped {} detections on a full queue", (long long)_dropped);
+	}
+}
+
+void DetectionPublisher::publish(const std::vector<UpdatePtr>& detections) {
+	for (const UpdatePtr& detection : detections) {
+		if (!_queue.push(detection)) {
+			_dropped++;
+		}
+	}
+}
+
+void DetectionPublisher::write() {
+	std::vector<UpdatePtr> batch;
+	while (1) {
+		batch.clear();
+		// a batch is whatever has queued up by the time the first detection arrives
+		_queue.pop(batch, INSERT_BATCH_ROWS, std::chrono::milliseconds(INSERT_BATCH_AGE_MS));
+		if (!batch.empty()) {
+			_db.pushUpdates(batch);
+		} else if (_stopping) {
+			break;
+		}
+	}
+}
@@ -1,24 +1,54 @@
 
+#include <cmath>
+
 #include <fmt/core.h>
 
 #include "Device.h"
 
+// Slack on the pre-test so float error never rejects a point on the view's edge
+#define VIEW_PRETEST_SLACK 1e-3f
+
 Device::Device(DeviceView view) : DeviceView(view) {
-	_db.connect();
+	_viewBox = this->view.calcBoundingBox();
+	// the view is built around +x then rotated by -angle, see DeviceView
+	_facing = glm::vec2(std::cos(-angle), std::sin(-angle));
+	_cosHalfAngle = std::cos(CAM_ANGLE / 2 + VIEW_PRETEST_SLACK);
+}
+
+bool Device::mightSee(glm::vec2 point) const {
+	glm::vec2 offset = point - pos;
+	float distanceSq = offset.x * offset.x + offset.y * offset.y;
+	float range = CAM_RANGE + VIEW_PRETEST_SLACK;
+	if (distanceSq > range * range) return false;
+	// inside the cone around _facing, the arc is flattened inwards so the sector contains the view
+	float along = offset.x * _facing.x + offset.y * _facing.y;
+	return along >= std::sqrt(distanceSq) * _cosHalfAngle - VIEW_PRETEST_SLACK;
 }
 
-void Device::run(const std::vector<EntityPtr>& entities) {
-	for (EntityPtr entity : entities) {
-		auto seen = _seenEntities.find(entity->id);
-		if (view.contains(entity->getPos()) && abs(M_PI - entity->getHeading() - angle) < M_PI / 4) {
-		// if (view.contains(entity->getPos())) {
-			if (seen == _seenEntities.end()) {
-				_seenEntities.insert(entity->id);
-				_db.getEntityFeatures(entity, id);
-				_db.pushUpdate(id, entity->getFacialFeatures());
+void Device::look(const EntityGrid& grid, const Crowd& crowd, const std::vector<EntityPtr>& entities, std::vector<int>& entered) {
+	entered.clear();
+	// entities outside these cells can't be in view, so anything seen that isn't
+	// in view now has left it
+	grid.near(_viewBox, _near);
+	std::set<int> inView;
+	for (int i : _near) {
+		const EntityPtr& entity = entities[i];
+		glm::vec2 entityPos = crowd.getPos(i);
+		if (abs(M_PI - crowd.getHeading(i) - angle) < M_PI / 4 && mightSee(entityPos) && view.contains(entityPos)) {
+		// if (view.contains(entityPos)) {
+			inView.insert(entity->id);
+			if (_seenEntities.find(entity->id) == _seenEntities.end()) {
+				entered.push_back(i);
 			}
-		} else if (seen != _seenEntities.end()) {
-			_seenEntities.erase(seen);
 		}
 	}
+	_seenEntities.swap(inView);
+}
+
+void Device::detect(const FeatureTable& features, const std::vector<EntityPtr>& entities, const std::vector<int>& entered, std::vector<UpdatePtr>& detections) {
+	for (int i : entered) {
+		boost::span<const UCHAR> entityFeatures = features.find(entities[i]->id, id);
+		if (entityFeatures.empty()) continue;
+		detections.push_back(UpdatePtr(new Update(-1, id, entityFeatures)));
+	}
 }
\ No newline at end of file
@@ -29,25 +29,23 @@ Display* Display::start() {
 
 void Display::setup() {
 	_font = ci::Font("Times New Roman", 18);
-
-	_db.connect();
-
 }
 
 void Display::update() {
 
 	static int limiter = 0;
 
-	if (limiter == 10) {
+	if (limiter == 10 && _dbPool != nullptr) {
 		limiter = 0;
+		DBConnectionPool::Lease db = _dbPool->lease();
 		_shortTermStates.clear();
-		_db.getShortTermStates(_shortTermStates, true);
+		db->getShortTermStates(_shortTermStates, true);
 
 		_particles.clear();
-		_db.getParticles(_particles);
+		db->getParticles(_particles);
 
 		if (_shortTermStates.size() > 0 && _shortTermStates[0]->longTermStateKey != -1) {
-			_pathGraph = _db.getLtsPath(_shortTermStates[0]->longTermStateKey, _db.getPeriod());
+			_pathGraph = db->getLtsPath(_shortTermStates[0]->longTermStateKey, db->getPeriod());
 		}
 	}
 	limiter++;
@@ -59,7 +57,7 @@ void Display::draw() {
 
 	ci::gl::clear(grey);
 
-	if (_map == nullptr || _entities == nullptr) {
+	if (_map == nullptr || _entities == nullptr || _crowd == nullptr || _dbPool == nullptr) {
 		return;
 	}
 
@@ -71,19 +69,19 @@ void Display::draw() {
 	ci::gl::scale(scale, scale);
 
 	ci::gl::color(ci::Color::white());
-	for (const ci::Shape2d& shape : _map->inBounds) {
-		ci::gl::drawSolid(shape);
+	for (const Shape2d& shape : _map->inBounds) {
+		ci::gl::drawSolid(ci::PolyLine2f(shape.getPoints()));
 	}
 
 	ci::gl::color(grey);
-	for (const ci::Shape2d& shape : _map->outBounds) {
-		ci::gl::drawSolid(shape);
+	for (const Shape2d& shape : _map->outBounds) {
+		ci::gl::drawSolid(ci::PolyLine2f(shape.getPoints()));
 	}
 
 	// Draw device views
 	ci::gl::color(ci::ColorA(170/255.0, 70/255.0, 190/255.0, 0.5));
 	for (const DeviceView devView : _map->devs) {
-		ci::gl::drawSolid(devView.view);
+		ci::gl::drawSolid(ci::PolyLine2f(devView.view.getPoints()));
 	}
 
 	// Draw doors
@@ -110,11 +108,11 @@ void Display::draw() {
 	// ci::gl::color(ci::Color::black());
 	// ci::gl::scale(1 / scale, 1 / scale);
 	// if (_entities->size() > 0) {
-	// 	const iGrid& pathMap = *(_map->getPathMap((*_entities)[0]->getNextDoor(2)));;
-	// 	// iGrid pathMap = _map->getDevicePathMap(19);
-	// 	for (int x = 0; x < pathMap.size(); x+=4) {
-	// 		for (int y = 0; y < pathMap[x].size(); y+=4) {
-	// 			ci::gl::Texture2dRef textTexture = ci::gl::Texture2d::create(tboxBase.text(std::to_string(pathMap[x][y])).render());
+	// 	const PathMap& pathMap = *(_map->getPathMap((*_entities)[0]->getNextDoor(2)));;
+	// 	// PathMap pathMap = _map->getDevicePathMap(19);
+	// 	for (int x = 0; x < pathMap.width(); x+=4) {
+	// 		for (int y = 0; y < pathMap.height(); y+=4) {
+	// 			ci::gl::Texture2dRef textTexture = ci::gl::Texture2d::create(tboxBase.text(std::to_string(pathMap.at(x, y))).render());
 	// 			ci::gl::draw(textTexture, (glm::vec2(x, y) * scale) - glm::vec2(tboxBase.getSize()) * 0.5f);
 	// 		}
 	// 	}
@@ -122,11 +120,12 @@ void Display::draw() {
 	// ci::gl::scale(scale, scale);
 	
 	// Draw entities
-	for (EntityPtr entity : *_entities) {
+	for (int i = 0; i < _entities->size(); i++) {
+		const EntityPtr& entity = (*_entities)[i];
 		ci::gl::ScopedModelMatrix model;
 		ci::gl::color(ci::Color(ci::CM_HSV, entity->id / (double) _entities->size(), 1.0, 1.0));
-		ci::gl::translate(entity->getPos());
-		ci::gl::rotate(entity->getHeading());
+		ci::gl::translate(_crowd->getPos(i));
+		ci::gl::rotate(_crowd->getHeading(i));
 		static glm::vec2 points[3] = { {-1.0, 1.0}, {-1.0, -1.0}, {1.0, 0.0} };
 		ci::gl::drawSolidTriangle(points);
 
@@ -134,11 +133,11 @@ void Display::draw() {
 		//ci::gl::scale(1 / scale, 1 / scale);
 		//ci::gl::color(ci::Color::black());
 		//ci::gl::Texture2dRef textTexture = ci::gl::Texture2d::create(tboxBase.text(std::to_string(entity->id)).render());
-		//glm::vec2 txtPos = (entity->getPos() * scale) - glm::vec2(tboxBase.getSize()) * 0.5f - glm::vec2(0, 10.0);
+		//glm::vec2 txtPos = (_crowd->getPos(i) * scale) - glm::vec2(tboxBase.getSize()) * 0.5f - glm::vec2(0, 10.0);
 		//ci::gl::draw(textTexture, txtPos);
 		//ci::gl::scale(scale, scale);
 
-		//ci::gl::drawSolidCircle(entity->getPos(), 1.0);
+		//ci::gl::drawSolidCircle(_crowd->getPos(i), 1.0);
 	}
 
 	// Draw sts as crosses
@@ -158,10 +157,9 @@ void Display::draw() {
 		// Draw path graph of first sts
 		ci::gl::color(ci::Color::black());
 		for (int i = 0; i < _map->devs.size(); i++) {
-			std::set<int> edges = PathGraph::getGraphEdges(i);
 			glm::vec2 nodePos = _map->devs[i].pos;
-			for (auto e = edges.begin(); e != edges.end(); e++) {
-				ci::gl::drawLine(nodePos, _map->devs[*e].pos);
+			for (int edge : PathGraph::getGraphEdges(i)) {
+				ci::gl::drawLine(nodePos, _map->devs[edge].pos);
 			}
 
 			ci::gl::scale(1 / scale, 1 / scale);
@@ -174,7 +172,10 @@ void Display::draw() {
 	}
 
 	// Draw Particles as circles
-	long long currentTime = _db.getTime().time_since_epoch().count();
+	// the db's clock, which the particle times come from, or ours if it can't be read
+	TimePoint now = std::chrono::time_point_cast<TimePoint::duration>(std::chrono::system_clock::now());
+	_dbPool->lease()->getTime(now);
+	long long currentTime = now.time_since_epoch().count();
 	// long long currentTime = std::chrono::high_resolution_clock::now().time_since_epoch().count();
 	std::vector<float> offsets(_map->devs.size());
 	for (Particle par : _particles) {
@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <cmath>
+
+#include "EntityGrid.h"
+
+EntityGrid::EntityGrid(glm::vec2 size, float cellSize) : _cellSize(cellSize) {
+	_columns = std::max(1, (int)std::ceil(size.x / cellSize) + 1);
+	_rows = std::max(1, (int)std::ceil(size.y / cellSize) + 1);
+}
+
+int EntityGrid::column(float x) const {
+	return std::clamp((int)std::floor(x / _cellSize), 0, _columns - 1);
+}
+
+int EntityGrid::row(float y) const {
+	return std::clamp((int)std::floor(y / _cellSize), 0, _rows - 1);
+}
+
+void EntityGrid::build(const Crowd& crowd) {
+	// counting sort by cell, entities stay in index order within a cell
+	_cellStart.assign(_columns * _rows + 1, 0);
+	_entityCells.resize(crowd.size());
+	for (int i = 0; i < crowd.size(); i++) {
+		glm::vec2 pos = crowd.getPos(i);
+		_entityCells[i] = cellOf(column(pos.x), row(pos.y));
+		_cellStart[_entityCells[i] + 1]++;
+	}
+	for (int cell = 0; cell < _columns * _rows; cell++) {
+		_cellStart[cell + 1] += _cellStart[cell];
+	}
+	_entries.resize(crowd.size());
+	std::vector<int> fill(_cellStart.begin(), _cellStart.end() - 1);
+	for (int i = 0; i < crowd.size(); i++) {
+		_entries[fill[_entityCells[i]]++] = i;
+	}
+}
+
+void EntityGrid::near(const Rect2d& box, std::vector<int>& found) const {
+	found.clear();
+	if (_cellStart.empty()) return;
+	for (int x = column(box.x1); x <= column(box.x2); x++) {
+		for (int y = row(box.y1); y <= row(box.y2); y++) {
+			int cell = cellOf(x, y);
+			found.insert(found.end(), _entries.begin() + _cellStart[cell], _entries.begin() + _cellStart[cell + 1]);
+		}
+	}
+	std::sort(found.begin(), found.end());
+}
@@ -0,0 +1,27 @@
+
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "FeatureTable.h"
+
+void FeatureTable::load(DBConnection& db) {
+	std::vector<std::pair<int, UpdatePtr>> rows;
+	db.getFacialData(rows);
+
+	_index.clear();
+	_index.reserve(rows.size());
+	_features.resize(rows.size() * FACE_VEC_SIZE);
+	for (int i = 0; i < rows.size(); i++) {
+		_index[key(rows[i].first, rows[i].second->deviceId)] = i;
+		memcpy(_features.data() + (size_t)i * FACE_VEC_SIZE, rows[i].second->facialFeatures.data(), FACE_VEC_SIZE * sizeof(float));
+	}
+	fmt::println("Loaded {} facial features", rows.size());
+}
+
+boost::span<const UCHAR> FeatureTable::find(int studentId, int deviceId) const {
+	auto it = _index.find(key(studentId, deviceId));
+	if (it == _index.end()) return boost::span<const UCHAR>();
+	const float* row = _features.data() + (size_t)it->second * FACE_VEC_SIZE;
+	return boost::span<const UCHAR>(reinterpret_cast<const UCHAR*>(row), FACE_VEC_SIZE * sizeof(float));
+}
@@ -1,27 +1,49 @@
 
 #include <chrono>
+#include <thread>
+#include <cstring>
 
 #include <fmt/core.h>
 
 #include "Simulation.h"
 
-Simulation::Simulation() {
+#define SIM_DB_CONNECTIONS 2
+// simulated seconds per tick
+#define SIM_TIMESTEP 0.2
+// the period is set by the server, checked this often in wall time
+#define SIM_PERIOD_POLL_MS 500
+// visibility grid cell, the camera range
+#define SIM_GRID_CELL 20.0
+// dataset students written per transaction, and rows per multi-row INSERT
+#define SIM_UPLOAD_STUDENTS 256
+#define SIM_UPLOAD_BATCH_ROWS 2048
+// pairs closer than this are compared byte for byte to find identical images, the
+// blocked distances come out of |a|^2 + |b|^2 - 2 a.b and are almost never exactly 0
+#define SIM_DUPLICATE_DISTANCE 1.0f
 
-    PathGraph::initGraph("../../../map.xml", "pathGraph.csv");
+typedef std::chrono::steady_clock Clock;
+
+Simulation::Simulation(int threads, float timeScale, bool headless) : _dbPool(SIM_DB_CONNECTIONS), _pool(threads), _timeScale(timeScale) {
+
+    PathGraph::initGraph("../../../map.xml", "pathGraph.bin");
 
 	_db.connect();
+	_dbPool.connect();
 
 	_db.clearTables();
 	_db.createTables();
     _db.initGlobals();
 
 	_map = Map("../../../map.xml");
-	_map.generatePathMaps();
+	_map.loadPathMaps("pathMaps.bin");
 
 	uploadDataSet("../../../dataset.csv", -1, false);
+	_features.load(_db);
 	_db.getEntities(_entities);
 	srand(5678975);
 	getSchedules();
+	_crowd.setMap(_map, _pool);
+	_crowd.resize(_entities.size());
 
 	printf("Creating devices ... ");
 
@@ -31,34 +53,82 @@ Simulation::Simulation() {
 
 	printf("Done\n");
 
-	_display = Display::start();
-	_display->setObservables(&_map, &_entities);
+	_publisher.start();
+
+#ifndef SIM_HEADLESS
+	if (!headless) {
+		_display = Display::start();
+		_display->setObservables(&_map, &_entities, &_crowd, &_dbPool);
+	}
+#endif
+}
+
+bool Simulation::record(const std::string& path) {
+	_trace = std::unique_ptr<TraceWriter>(new TraceWriter(path));
+	if (!_trace->valid()) {
+		_trace.reset();
+		return false;
+	}
+	fmt::println("Recording detections to {}", path);
+	return true;
 }
 
 void Simulation::run() {
 	std::this_thread::sleep_for(std::chrono::milliseconds(500));
 
-	printf("Running simulation...\n");
+	if (_timeScale > 0) {
+		fmt::println("Running simulation at {}x on {} threads, {} crowd steps...", _timeScale, _pool.size(), Crowd::kernel());
+	} else {
+		fmt::println("Running simulation unthrottled on {} threads, {} crowd steps...", _pool.size(), Crowd::kernel());
+	}
 
 	int period = 0;
+	std::vector<UpdatePtr> detections;
+	std::vector<std::vector<int>> entered(_devices.size());
+	EntityGrid grid(_map.size, SIM_GRID_CELL);
+
+	Clock::time_point start = Clock::now();
+	Clock::time_point lastPoll;
+	long long tick = 0;
 
 	while (1) {
-		if (_db.getPeriod() != period) {
-			period = _db.getPeriod();
-			for (EntityPtr entity : _entities) {
-				entity->setPathMap(_map.getPathMap(entity->getNextDoor(period)));
-				if (period == 1) {
-					entity->setStartPos(_map.doors[0].pos);
+		if (tick == 0 || Clock::now() - lastPoll >= std::chrono::milliseconds(SIM_PERIOD_POLL_MS)) {
+			lastPoll = Clock::now();
+			if (_trace) {
+				_trace->flush();
+			}
+			int nowPeriod = _db.getPeriod();
+			if (nowPeriod != period) {
+				period = nowPeriod;
+				for (int i = 0; i < _entities.size(); i++) {
+					_crowd.setTarget(i, _entities[i]->getNextDoor(period));
+					if (period == 1) {
+						_crowd.setPos(i, _map.doors[0].pos);
+					}
 				}
 			}
 		}
-		for (EntityPtr entity : _entities) {
-			entity->step(0.2);
+
+		// the crowd steps in blocks of agents, devices only update what they've seen
+		_crowd.step(SIM_TIMESTEP, _pool);
+		grid.build(_crowd);
+		_pool.parallelFor(_devices.size(), [&](int i) { _devices[i]->look(grid, _crowd, _entities, entered[i]); });
+		// detections are collected in device order and logged by the publisher's thread
+		for (int i = 0; i < _devices.size(); i++) {
+			_devices[i]->detect(_features, _entities, entered[i], detections);
+		}
+		if (_trace) {
+			_trace->write((int64_t)(tick * SIM_TIMESTEP * 1e6), detections);
 		}
-		for (Device* dev : _devices) {
-			dev->run(_entities);
+		_publisher.publish(detections);
+		detections.clear();
+
+		tick++;
+		if (_timeScale > 0) {
+			// each tick is due SIM_TIMESTEP / timeScale after the last, a slow tick is caught up
+			std::chrono::duration<double> simulated(tick * SIM_TIMESTEP / _timeScale);
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(simulated));
 		}
-		// std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 }
 
@@ -68,13 +138,13 @@ void Simulation::uploadDataSet(std::string filename, int max, bool startingData)
 		return;
 	}
 
-	FFMat R = FFMat::Zero();
+	FFCov R = FFCov::Zero();
 	if (startingData) {
 	    loadUpdateCov("../../../updateCov.csv", R);
 	}
 
-	std::vector<std::vector<std::vector<float>>> dataSet;
-	std::vector<std::vector<float>> currentEntity;
+	// every image, entity major, for the distance histograms
+	std::vector<float> faces;
 	fmt::println("Uploading dataset to db from {} ... ", filename);
 
 	if (startingData) {
@@ -82,98 +152,64 @@ void Simulation::uploadDataSet(std::string filename, int max, bool startingData)
 	}
 
 	try {
-		std::ifstream file(filename);
-		int updateNum = 0;
-		int entity = 0;
-		if (file.is_open()) {
-			std::string line;
-
-			std::getline(file, line);
-			std::stringstream s(line);
-			std::string num;
-			std::getline(s, num, ',');
-			int entities = stoi(num);
-			std::getline(s, num, ',');
-			int imgs = stoi(num);
-
-			while (1) {
-				std::getline(file, line);
-				if (file.eof()) break;
-				s = std::stringstream(line);
-				UpdatePtr data = UpdatePtr(new Update(0, updateNum));
-				int feature = 0;
-				std::vector<float> vec;
-				while (std::getline(s, num, ',')) {
-					data->facialFeatures[feature] = stof(num);
-					feature++;
-					vec.push_back(stof(num));
-				}
-				currentEntity.push_back(vec);
-				if (feature != FACE_VEC_SIZE) {
-					throw std::runtime_error("improper feature vector dimensions\n");
-				}
-				if (updateNum == 0) {
-					entity = _db.addStudent();
-					
-					if (startingData) {
-						LongTermStatePtr lts = LongTermStatePtr(new LongTermState(-1, data->facialFeatures, R, entity));
-						_db.addLongTermState(lts);
-					}
-				}
-				_db.pushStudentData(data, entity);
+		DataSetReader reader(filename);
+		if (!reader.valid()) {
+			throw std::runtime_error("missing file or header\n");
+		}
+		int imgs = reader.images();
+		int entities = max == -1 ? reader.entities() : std::min(reader.entities(), max);
 
-				updateNum++;
-				if (updateNum == imgs) {
-					updateNum = 0;
-					dataSet.push_back(currentEntity);
-					currentEntity.clear();
-				}
-				if (dataSet.size() == max) break;
-			}
-			if (updateNum != 0) {
-				throw std::runtime_error("inproper alignment\n");
-			}
-			if (entity != entities && max == -1) {
-				throw std::runtime_error("unexpected number of entities\n");
+		Clock::time_point start = Clock::now();
+		long long rows = 0;
+		int entity = 0;
+		std::vector<float> features;
+		std::vector<int> studentIds;
+		InsertBatch studentData = DBConnection::studentDataBatch(SIM_UPLOAD_BATCH_ROWS);
+		InsertBatch longTermStates = DBConnection::longTermStatesBatch(SIM_UPLOAD_BATCH_ROWS);
+		while (entity < entities) {
+			// parse a chunk of students, then create them and write their rows in one transaction
+			features.clear();
+			int students = 0;
+			while (students < SIM_UPLOAD_STUDENTS && entity + students < entities && reader.next(features)) {
+				students++;
 			}
-		}
-		file.close();
-		printf("Done\n");
-
-		std::ofstream distancesFile("distances.csv");
-		for (int entity = 0; entity < dataSet.size() - 1; entity++) {
-			for (int otherEntity = entity + 1; otherEntity < dataSet.size(); otherEntity++) {
-				for (int i = 0; i < dataSet[entity].size(); i++) {
-					for (int j = 0; j < dataSet[otherEntity].size(); j++) {
-						float distance = 0.0;
-						for (int k = 0; k < FACE_VEC_SIZE; k++) {
-							distance += pow(dataSet[entity][i][k] - dataSet[otherEntity][j][k], 2);
-						}
-						if (distance != 0.0) {
-							distancesFile << std::to_string(distance) << ", ";
-						}
+			if (students == 0) break;
+
+			long long errors = _db.errors();
+			_db.beginTransaction();
+			studentIds.clear();
+			_db.addStudents(students, studentIds);
+			for (int s = 0; s < students; s++) {
+				for (int img = 0; img < imgs; img++) {
+					const float* vec = features.data() + ((size_t)s * imgs + img) * FACE_VEC_SIZE;
+					boost::span<const UCHAR> bytes(reinterpret_cast<const UCHAR*>(vec), FACE_VEC_SIZE * sizeof(float));
+					// the first image of each student seeds its long term state
+					if (startingData && img == 0) {
+						_db.addLongTermState(longTermStates, LongTermStatePtr(new LongTermState(-1, FFVec(Eigen::Map<const FFVec>(vec)), R, studentIds[s])));
 					}
+					_db.pushStudentData(studentData, studentIds[s], img, bytes);
 				}
 			}
-		}
-		distancesFile << "\n";
-		for (int entity = 0; entity < dataSet.size(); entity++) {
-			for (int i = 0; i < dataSet[entity].size() - 1; i++) {
-				for (int j = i + 1; j < dataSet[entity].size(); j++) {
-					float distance = 0.0;
-					for (int k = 0; k < FACE_VEC_SIZE; k++) {
-						distance += pow(dataSet[entity][i][k] - dataSet[entity][j][k], 2);
-					}
-					if (distance != 0.0) {
-						distancesFile << std::to_string(distance) << ", ";
-					}
-				}
+			faces.insert(faces.end(), features.begin(), features.end());
+			_db.flush(studentData);
+			_db.flush(longTermStates);
+			if (_db.errors() != errors) {
+				_db.rollbackTransaction();
+				throw std::runtime_error("failed to write students\n");
 			}
+			_db.commitTransaction();
+
+			entity += students;
+			rows += students * (long long)imgs;
+		}
+		if (entity != entities) {
+			throw std::runtime_error("unexpected number of entities\n");
 		}
 
-		distancesFile << "\n";
-		distancesFile.close();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		fmt::println("Uploaded {} students and {} facial data rows in {:.2f} s, {:.0f} rows/s", entity, rows, seconds, rows / std::max(seconds, 1e-9));
 
+		writeDistances(faces, imgs, "distances.csv");
 	}
 	catch (const std::exception& err) {
 		std::cerr << "Failed to read dataset: " << err.what() << std::endl;
@@ -210,4 +246,48 @@ void Simulation::getSchedules() {
 	}
 
 	printf("Done\n");
-}
\ No newline at end of file
+}
+void Simulation::writeDistances(const std::vector<float>& faces, int imgs, const std::string& path) {
+	int n = faces.size() / FACE_VEC_SIZE;
+	Clock::time_point start = Clock::now();
+
+	// one pair of histograms per pool thread, merged once every tile is done
+	std::vector<DistanceHistogram> inter(_pool.size() + 1);
+	std::vector<DistanceHistogram> intra(_pool.size() + 1);
+	pairwiseL2Distances(faces.data(), n, _pool, [&](const DistanceTile& tile) {
+		int thread = ThreadPool::workerIndex() + 1;
+		for (int r = 0; r < tile.rows; r++) {
+			int i = tile.rowBegin + r;
+			for (int c = 0; c < tile.cols; c++) {
+				int j = tile.colBegin + c;
+				if (j <= i) continue;
+				float distance = tile.distances[r * tile.cols + c];
+				// identical images aren't a real pair
+				if (distance < SIM_DUPLICATE_DISTANCE &&
+					memcmp(faces.data() + (size_t)i * FACE_VEC_SIZE, faces.data() + (size_t)j * FACE_VEC_SIZE, FACE_VEC_SIZE * sizeof(float)) == 0) continue;
+				if (i / imgs == j / imgs) {
+					intra[thread].add(distance);
+				} else {
+					inter[thread].add(distance);
+				}
+			}
+		}
+	});
+	for (int thread = 1; thread < inter.size(); thread++) {
+		inter[0].merge(inter[thread]);
+		intra[0].merge(intra[thread]);
+	}
+
+	// squared distance at each bin's upper edge, then pairs of different and of the same entity in the bin
+	std::ofstream file(path);
+	file << "distance, inter, intra\n";
+	for (int bin = 0; bin < inter[0].bins(); bin++) {
+		file << fmt::format("{}, {}, {}\n", (bin + 1) * inter[0].binWidth(), inter[0].at(bin), intra[0].at(bin));
+	}
+	file.close();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	fmt::println("Wrote distance histograms of {} faces to {} in {:.2f} s ({} kernel)", n, path, seconds, faceDistanceKernel());
+	fmt::println("Same entity p50 {:.1f} p95 {:.1f}, different entities p1 {:.1f} p5 {:.1f}",
+		intra[0].quantile(0.5), intra[0].quantile(0.95), inter[0].quantile(0.01), inter[0].quantile(0.05));
+}
@@ -1,11 +1,36 @@
 #include <iostream>
+#include <string>
 
 #include "Simulation.h"
-#include "Display.h"
 
-int main() {
+int main(int argc, char* argv[]) {
 
-    Simulation sim;
+    int threads = 0;
+    float timeScale = 1.0;
+    bool headless = false;
+    std::string tracePath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+            Map::setThreads(threads);
+        }
+        // simulated seconds per wall second, 0 runs unthrottled
+        if (arg == "--time-scale" && i + 1 < argc) {
+            timeScale = std::stof(argv[++i]);
+        }
+        if (arg == "--headless") {
+            headless = true;
+        }
+        if (arg == "--record" && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+    }
+
+    Simulation sim(threads, timeScale, headless);
+    if (!tracePath.empty()) {
+        sim.record(tracePath);
+    }
     sim.run();
     
     return 0;
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "Map.h"
+#include "ThreadPool.h"
+
+// Positions, headings and target doors of every simulated entity as contiguous
+// arrays, agent i being entity i. Each door's path map is reduced once to a
+// flow field, the neighbour to step towards from every cell, so a step is one
+// byte lookup per agent and runs over blocks of agents with SIMD.
+class Crowd {
+public:
+
+	Crowd() {}
+
+	// Builds a flow field per door from the map's door path maps
+	void setMap(const Map& map, ThreadPool& pool);
+	void resize(int size);
+
+	int size() const { return _x.size(); }
+	glm::vec2 getPos(int i) const { return { _x[i], _y[i] }; }
+	float getHeading(int i) const { return _heading[i]; }
+
+	void setPos(int i, glm::vec2 pos) { _x[i] = pos.x; _y[i] = pos.y; }
+	// Door the agent walks to, -1 stands still
+	void setTarget(int i, int door) { _target[i] = door; }
+
+	// Moves every agent dt towards its door
+	void step(float dt, ThreadPool& pool);
+
+	static const char* kernel();
+
+private:
+
+	void stepBlock(int begin, int end, float dt);
+
+	int _width = 0;
+	int _height = 0;
+	// direction to step in, door * _width * _height + cell, padded so a 4 byte gather can read the last cell
+	std::vector<uint8_t> _flow;
+
+	std::vector<float> _x;
+	std::vector<float> _y;
+	std::vector<float> _heading;
+	std::vector<int32_t> _target;
+
+};
@@ -1,17 +1,80 @@
 #pragma once
 
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <memory>
+
 #include <boost/core/span.hpp>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/mysql/tcp_ssl.hpp>
+#include <boost/mysql/statement.hpp>
+#include <boost/mysql/results.hpp>
+#include <boost/mysql/error_with_diagnostics.hpp>
+#include <boost/mysql/field.hpp>
+#include <boost/mysql/field_view.hpp>
 
 #include "EntityState.h"
 #include "PathGraph.h"
+#include "Ingest.h"
+
+// Wait between reconnect attempts, doubling from min to max while the server stays down
+#define DB_RECONNECT_MIN_MS 250
+#define DB_RECONNECT_MAX_MS 30000
+
+// Default thresholds at which an InsertBatch asks to be flushed
+#define INSERT_BATCH_ROWS 256
+#define INSERT_BATCH_AGE_MS 100
 
 typedef boost::mysql::datetime::time_point TimePoint;
 
+// Executions and round trip time of one prepared statement on a connection
+struct StatementStats {
+    std::string sql;
+    long long executions = 0;
+    double totalMs = 0;
+    double maxMs = 0;
+};
+
+// Rows for one table collected client side and written with multi-row INSERTs
+// by DBConnection::flush. Values are copied, so the sources can go away.
+class InsertBatch {
+public:
+
+    InsertBatch(std::string table, std::vector<std::string> columns,
+        size_t maxRows = INSERT_BATCH_ROWS, std::chrono::milliseconds maxAge = std::chrono::milliseconds(INSERT_BATCH_AGE_MS));
+
+    // One value per column, in column order
+    template<class... Args>
+    void add(const Args&... args);
+
+    size_t rows() const { return _rows; }
+    bool empty() const { return _rows == 0; }
+    // Full, or the oldest row has waited longer than maxAge
+    bool due() const;
+    void clear();
+
+private:
+
+    friend class DBConnection;
+
+    std::string sql(size_t rows) const;
+
+    std::string _table;
+    std::vector<std::string> _columns;
+    size_t _maxRows;
+    std::chrono::milliseconds _maxAge;
+
+    std::vector<boost::mysql::field> _values;
+    size_t _rows = 0;
+    std::chrono::steady_clock::time_point _firstAdded;
+
+};
+
 class DBConnection {
 public:
 
@@ -19,7 +82,39 @@ public:
     ~DBConnection();
 
     bool connect();
+    // Reconnects unless still backing off from a failed attempt
+    bool reconnect();
+    // Round trip to the server, marks the connection broken if it fails
+    bool ping();
+    bool healthy() const { return _healthy; }
+    std::chrono::steady_clock::time_point lastUsed() const { return _lastUsed; }
+
     bool query(const char* sql, boost::mysql::results& result);
+
+    // While a transaction is open a dropped connection is not reconnected, the
+    // statements after it fail instead so the caller can tell and roll back
+    bool beginTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+    bool inTransaction() const { return _inTransaction; }
+    // Failed statements so far, most methods only print their errors
+    long long errors() const { return _errors; }
+
+    // Statements are prepared the first time their sql is seen and reused for the life of the
+    // session. A reconnect drops them and they are prepared again on next use.
+    template<class... Args>
+    void execute(const char* sql, boost::mysql::results& result, const Args&... args);
+
+    void getStatementStats(std::vector<StatementStats>& stats);
+    void printStatementStats();
+    static void printStatementStats(const std::vector<StatementStats>& stats);
+    void resetStatementStats();
+
+    // Writes the batch in as few statements as possible and clears it. ids, when
+    // given, receives the auto increment id of every row in order, -1 for rows that
+    // weren't written. Returns false if a statement failed, which also counts in errors().
+    bool flush(InsertBatch& batch, std::vector<int>* ids = nullptr);
+    bool flushIfDue(InsertBatch& batch);
     
     void createTables();
     void clearTables();
@@ -27,8 +122,12 @@ public:
     void getEntities(std::vector<EntityPtr>& vec);
     bool getEntityFeatures(EntityPtr entity, int devId);
     void getEntitiesFeatures(std::vector<EntityPtr>& vec);
+    // Every facial_data row as (student id, features with the row's device id)
+    void getFacialData(std::vector<std::pair<int, UpdatePtr>>& rows);
 
     void pushUpdate(int devId, const boost::span<UCHAR> facialFeatures);
+    // Logs all updates in one round trip and fills in their ids
+    void pushUpdates(const std::vector<UpdatePtr>& updates);
     void getNewUpdates(std::vector<UpdatePtr>& updates);
     void updateUpdate(UpdatePtr update);
     void removeUpdate(UpdatePtr update);
@@ -42,10 +141,14 @@ public:
     void clearParticles();
 
     void addParticleTime(Particle particle, int deviceId, TimePoint expectedTime);
+    static InsertBatch particleTimesBatch();
+    void addParticleTime(InsertBatch& batch, Particle particle, int deviceId, TimePoint expectedTime);
 
     LongTermStatePtr getLongTermState(int id);
     void getLongTermStates(std::vector<LongTermStatePtr>& states);
     int addLongTermState(LongTermStatePtr lts);
+    static InsertBatch longTermStatesBatch(size_t maxRows = INSERT_BATCH_ROWS);
+    void addLongTermState(InsertBatch& batch, LongTermStatePtr lts);
     int createLongTermState(ShortTermStatePtr sts);
     void updateLongTermState(LongTermStatePtr lts);
     void setLongTermStateStudent(LongTermStatePtr lts);
@@ -71,19 +174,92 @@ public:
     void setAttendance(int room, int period, int studentId, AttendanceStatus status);
 
     int getPeriod();
+    // False, with both -1, when the query fails or globals has no row
+    bool getGlobals(int& period, int& epoch);
     void setPeriod(int period);
+    void bumpStateEpoch();
 
     int addStudent();
+    void addStudents(int count, std::vector<int>& ids);
     void pushStudentData(UpdatePtr data, int studentId);
+    static InsertBatch studentDataBatch(size_t maxRows = INSERT_BATCH_ROWS);
+    void pushStudentData(InsertBatch& batch, int studentId, int deviceId, boost::span<const UCHAR> facialFeatures);
 
     void initGlobals();
 
-    TimePoint getTime();
+    // The server's clock, false if it couldn't be read
+    bool getTime(TimePoint& time);
 
 private:
 
     boost::asio::io_context _ctx;
     boost::asio::ssl::context _ssl_ctx;
-    boost::mysql::tcp_ssl_connection _conn;
+    std::unique_ptr<boost::mysql::tcp_ssl_connection> _conn;
+
+    // A broken connection is reconnected on its next use
+    void ensureConnected();
+    void noteError(const boost::mysql::error_with_diagnostics& err);
+    bool _healthy = false;
+    // Multi-row inserts get consecutive auto increment ids unless innodb_autoinc_lock_mode
+    // is 2 (interleaved), checked on connect
+    bool _consecutiveIds = false;
+    std::chrono::steady_clock::time_point _lastUsed;
+    std::chrono::steady_clock::time_point _retryAt;
+    std::chrono::milliseconds _backoff{ 0 };
+    bool _inTransaction = false;
+    long long _errors = 0;
+
+    struct CachedStatement {
+        boost::mysql::statement statement;
+        StatementStats stats;
+    };
+    // Returns the cached entry for sql, preparing it on this session if needed
+    CachedStatement& prepare(const char* sql);
+    // Runs a cached statement bound by bind(statement)
+    template<class Bind>
+    void run(const char* sql, boost::mysql::results& result, const Bind& bind);
+    void recordExecution(CachedStatement& cached, std::chrono::steady_clock::time_point start);
+    static bool isStaleStatement(const boost::mysql::error_with_diagnostics& err);
+
+    std::unordered_map<std::string, CachedStatement> _statements;
+
+    std::unique_ptr<IngestClient> _ingest;
+
+};
+
+template<class... Args>
+void InsertBatch::add(const Args&... args) {
+    if (_rows == 0) _firstAdded = std::chrono::steady_clock::now();
+    (_values.emplace_back(boost::mysql::field_view(args)), ...);
+    _rows++;
+}
+
+template<class... Args>
+void DBConnection::execute(const char* sql, boost::mysql::results& result, const Args&... args) {
+    run(sql, result, [&](const boost::mysql::statement& statement) { return statement.bind(args...); });
+}
 
-};
\ No newline at end of file
+template<class Bind>
+void DBConnection::run(const char* sql, boost::mysql::results& result, const Bind& bind) {
+    try {
+        ensureConnected();
+        CachedStatement* cached = &prepare(sql);
+        auto start = std::chrono::steady_clock::now();
+        try {
+            _conn->execute(bind(cached->statement), result);
+        }
+        catch (const boost::mysql::error_with_diagnostics& err) {
+            // the server lost the statement behind our back, prepare it again and retry once
+            if (!isStaleStatement(err)) throw;
+            cached->statement = boost::mysql::statement();
+            prepare(sql);
+            start = std::chrono::steady_clock::now();
+            _conn->execute(bind(cached->statement), result);
+        }
+        recordExecution(*cached, start);
+    }
+    catch (const boost::mysql::error_with_diagnostics& err) {
+        noteError(err);
+        throw;
+    }
+}
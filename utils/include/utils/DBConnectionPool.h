@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "DBConnection.h"
+
+// Connections idle longer than this are pinged before being leased out
+#define DB_POOL_IDLE_CHECK_MS 30000
+
+// Fixed set of connections shared between threads. A lease hands out one
+// connection exclusively and gives it back when it goes out of scope.
+class DBConnectionPool {
+public:
+
+    class Lease {
+    public:
+
+        Lease(Lease&& other) noexcept : _pool(other._pool), _conn(other._conn) { other._conn = nullptr; }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { if (_conn != nullptr) _pool->release(_conn); }
+
+        DBConnection& operator*() const { return *_conn; }
+        DBConnection* operator->() const { return _conn; }
+
+    private:
+
+        friend class DBConnectionPool;
+        Lease(DBConnectionPool* pool, DBConnection* conn) : _pool(pool), _conn(conn) {}
+
+        DBConnectionPool* _pool;
+        DBConnection* _conn;
+
+    };
+
+    DBConnectionPool(int size = 4);
+
+    // Opens every connection, false if none could be opened
+    bool connect();
+
+    int size() const { return _connections.size(); }
+
+    // Blocks until a connection is free. Broken or long idle connections are
+    // checked and reconnected (with backoff) before being handed out.
+    Lease lease();
+
+    // Statement stats of every connection, waits for all leases to be returned
+    void getStatementStats(std::vector<StatementStats>& stats);
+
+private:
+
+    void release(DBConnection* conn);
+
+    std::vector<std::unique_ptr<DBConnection>> _connections;
+    std::vector<DBConnection*> _free;
+
+    std::mutex _mutex;
+    std::condition_variable _available;
+
+};
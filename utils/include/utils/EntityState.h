@@ -1,9 +1,12 @@
 #pragma once
 
 #include <memory>
+#include <chrono>
+#include <cstring>
+#include <string>
 
 #include <boost/core/span.hpp>
-#include <Eigen/dense>
+#include <Eigen/Dense>
 
 #include "utils/Map.h"
 #include "utils/PathGraph.h"
@@ -14,7 +17,16 @@ typedef unsigned char UCHAR;
 typedef Eigen::Matrix<float, FACE_VEC_SIZE, 1> FFVec;
 typedef Eigen::Matrix<float, FACE_VEC_SIZE, FACE_VEC_SIZE> FFMat;
 
-void loadUpdateCov(std::string filename, FFMat& R);
+// Facial feature covariances are stored as their diagonal unless the build
+// defines FACE_COV_DENSE. R is only ever filled on the diagonal and H is
+// identity, so the kalman update never produces off diagonal terms.
+#ifdef FACE_COV_DENSE
+typedef FFMat FFCov;
+#else
+typedef FFVec FFCov;
+#endif
+
+void loadUpdateCov(std::string filename, FFCov& R);
 double l2Distance(const FFVec& first, const FFVec& second);
 
 class Update;
@@ -24,13 +36,13 @@ public:
 
 	int id;
 	FFVec facialFeatures;
-	FFMat facialFeaturesCov;
+	FFCov facialFeaturesCov;
 
 	EntityState(int id_) {
 		id = id_;
 	}
 
-	EntityState(int id_, FFVec facialFeatures_, FFMat facialFeaturesCov_) {
+	EntityState(int id_, FFVec facialFeatures_, FFCov facialFeaturesCov_) {
 		id = id_;
 		facialFeatures = facialFeatures_;
 		facialFeaturesCov = facialFeaturesCov_;
@@ -42,13 +54,15 @@ public:
 	}
 
 	EntityState(int id_, boost::span<const UCHAR> facialFeatures_, boost::span<const UCHAR> facialFeaturesCov_) : EntityState(id_, facialFeatures_) {
-		memcpy(facialFeaturesCov.data(), facialFeaturesCov_.data(), facialFeaturesCov_.size_bytes());
+		setFacialFeaturesCov(facialFeaturesCov_);
 	}
 
 	const boost::span<UCHAR> getFacialFeatures() const { return boost::span<UCHAR>(reinterpret_cast<UCHAR*>(const_cast<float*>(facialFeatures.data())), facialFeatures.size() * sizeof(float)); }
 	void setFacialFeatures(boost::span<const UCHAR> facialFeatures_) {
 		memcpy(facialFeatures.data(), facialFeatures_.data(), facialFeatures_.size_bytes());
 	}
+	// Accepts both dense and diagonal blobs, converting to the built format
+	void setFacialFeaturesCov(boost::span<const UCHAR> facialFeaturesCov_);
 	virtual const boost::span<UCHAR> getFacialFeaturesCovSpan() const { return boost::span<UCHAR>(reinterpret_cast<UCHAR*>(const_cast<float*>(facialFeaturesCov.data())), facialFeaturesCov.size() * sizeof(float)); }
 
 	void kalmanUpdate(std::shared_ptr<EntityState> update);
@@ -74,21 +88,8 @@ public:
 
 	Entity(int id, boost::span<const UCHAR> facialFeatures) : EntityState(id, facialFeatures) {}
 
-	void step(float dt);
-
-	int 
-	getNextDoor(int period) const { return schedule[period - 1]; }
-	const glm::vec2& getPos() const { return _pos; }
-	float getHeading() const { return _heading; }
-
-	void setPathMap(const iGrid* pathMap) { _pathMap = pathMap; }
-	void setStartPos(glm::vec2 pos) { _pos = pos; }
-
-private:
-
-	glm::vec2 _pos = {0,0};
-	float _heading = 0.0;
-	const iGrid* _pathMap = nullptr;
+	// Positions and headings live in the simulation's Crowd
+	int getNextDoor(int period) const { return schedule[period - 1]; }
 
 };
 
@@ -118,7 +119,7 @@ public:
 
 	int studentId;
 
-	LongTermState(int id_, FFVec facialFeatures_, FFMat facialFeaturesCov_, int studentId_) : EntityState(id_, facialFeatures_, facialFeaturesCov_) {
+	LongTermState(int id_, FFVec facialFeatures_, FFCov facialFeaturesCov_, int studentId_) : EntityState(id_, facialFeatures_, facialFeaturesCov_) {
 		studentId = studentId_;
 	}
 
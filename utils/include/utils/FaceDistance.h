@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "EntityState.h"
+#include "ThreadPool.h"
+
+// Contiguous structure-of-arrays store of facial feature means.
+// Row k holds feature k of every candidate, so the distance kernels can
+// stream each feature across many candidates at once.
+class FaceMatrix {
+public:
+
+    FaceMatrix() {}
+
+    int size() const { return _size; }
+    int stride() const { return _stride; }
+    const float* feature(int k) const { return _data.data() + (size_t)k * _stride; }
+
+    int add(const FFVec& features);
+    void set(int index, const FFVec& features);
+    FFVec get(int index) const;
+    void remove(int index);
+    void clear();
+    void reserve(int capacity);
+
+private:
+
+    int _size = 0;
+    int _stride = 0;
+    std::vector<float> _data;
+
+};
+
+struct FaceMatch {
+    int index;
+    float distance;
+};
+
+const char* faceDistanceKernel();
+
+// Squared l2 distance from query to every candidate, distances[i] for column i
+void batchL2Distance(const FFVec& query, const FaceMatrix& candidates, std::vector<float>& distances);
+
+// Candidates closer than thresh, nearest first, at most k of them if k > 0
+void batchL2Matches(const FFVec& query, const FaceMatrix& candidates, float thresh, std::vector<FaceMatch>& matches, int k = -1);
+
+// Tile of the pairwise distance matrix, distances[r * cols + c] is between
+// faces rowBegin + r and colBegin + c. Tiles on the diagonal also hold the
+// pairs with colBegin + c <= rowBegin + r, which callers skip.
+struct DistanceTile {
+    int rowBegin;
+    int rows;
+    int colBegin;
+    int cols;
+    const float* distances;
+};
+
+// Squared l2 distance between every pair of n faces, faces being a row major
+// n x FACE_VEC_SIZE matrix. Computed as |a|^2 + |b|^2 - 2 a.b over cache sized
+// tiles, only tiles on or above the diagonal. fn sees each tile once and is
+// called from the pool's threads concurrently; the matrix itself is never stored.
+void pairwiseL2Distances(const float* faces, int n, ThreadPool& pool, const std::function<void(const DistanceTile&)>& fn);
+
+// Counts of squared distances in equal width bins over [0, max), the last bin
+// also counts everything past max
+class DistanceHistogram {
+public:
+
+    DistanceHistogram(float max = 512.0f, int bins = 2048);
+
+    void add(float distance) { _counts[std::min(_bins - 1, (int)(std::max(distance, 0.0f) * _scale))]++; }
+    void merge(const DistanceHistogram& other);
+
+    int bins() const { return _bins; }
+    float binWidth() const { return 1.0f / _scale; }
+    long long at(int bin) const { return _counts[bin]; }
+    long long count() const;
+    // Upper edge of the bin holding the q quantile
+    float quantile(double q) const;
+
+private:
+
+    int _bins;
+    float _scale;
+    std::vector<long long> _counts;
+
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#include "EntityState.h"
+#include "FaceDistance.h"
+
+enum FaceIndexType {
+    BRUTE_FORCE_INDEX,
+    HNSW_INDEX
+};
+
+struct FaceNeighbor {
+    int id;
+    float distance;
+};
+
+// Nearest neighbour lookup of state means by squared l2 distance.
+// Ids are the state ids, results are nearest first.
+class FaceIndex {
+public:
+
+    virtual ~FaceIndex() {}
+
+    static std::unique_ptr<FaceIndex> create(FaceIndexType type);
+
+    virtual void insert(int id, const FFVec& features) = 0;
+    virtual void update(int id, const FFVec& features) = 0;
+    virtual void remove(int id) = 0;
+    virtual void clear() = 0;
+
+    virtual bool contains(int id) const = 0;
+    virtual int size() const = 0;
+
+    // Up to k neighbours closer than maxDistance, k <= 0 returns all of them
+    virtual void search(const FFVec& query, int k, float maxDistance, std::vector<FaceNeighbor>& neighbors) const = 0;
+
+};
+
+typedef std::unique_ptr<FaceIndex> FaceIndexPtr;
+
+class BruteForceFaceIndex : public FaceIndex {
+public:
+
+    void insert(int id, const FFVec& features) override;
+    void update(int id, const FFVec& features) override;
+    void remove(int id) override;
+    void clear() override;
+
+    bool contains(int id) const override { return _columns.find(id) != _columns.end(); }
+    int size() const override { return _means.size(); }
+
+    void search(const FFVec& query, int k, float maxDistance, std::vector<FaceNeighbor>& neighbors) const override;
+
+private:
+
+    FaceMatrix _means;
+    std::vector<int> _ids;
+    std::unordered_map<int, int> _columns;
+
+};
+
+// Hierarchical navigable small world graph, see Malkov & Yashunin 2016.
+// Removed nodes stay in the graph as routing points until enough of them pile
+// up, then the graph is rebuilt from the live nodes.
+class HnswFaceIndex : public FaceIndex {
+public:
+
+    HnswFaceIndex(int m = 16, int efConstruction = 200, int efSearch = 64);
+
+    void insert(int id, const FFVec& features) override;
+    void update(int id, const FFVec& features) override;
+    void remove(int id) override;
+    void clear() override;
+
+    bool contains(int id) const override { return _nodeIds.find(id) != _nodeIds.end(); }
+    int size() const override { return _nodeIds.size(); }
+
+    void search(const FFVec& query, int k, float maxDistance, std::vector<FaceNeighbor>& neighbors) const override;
+
+    void setEfSearch(int efSearch) { _efSearch = efSearch; }
+
+private:
+
+    struct Node {
+        int id;
+        bool removed;
+        FFVec features;
+        std::vector<std::vector<int>> links;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    typedef std::pair<float, int> Candidate;
+
+    float distance(const FFVec& a, int node) const;
+    float distance(int a, int b) const;
+    int greedyClosest(const FFVec& query, int entry, int fromLevel, int toLevel) const;
+    void searchLayer(const FFVec& query, int entry, int ef, int level, std::vector<Candidate>& found) const;
+    void selectNeighbors(std::vector<Candidate>& candidates, int m) const;
+    void connect(int node, int level, std::vector<Candidate>& candidates);
+    void rebuild();
+
+    int _m;
+    int _mMax0;
+    int _efConstruction;
+    int _efSearch;
+    double _levelMult;
+
+    int _entry = -1;
+    int _maxLevel = -1;
+    int _removed = 0;
+
+    std::vector<std::unique_ptr<Node>> _nodes;
+    std::unordered_map<int, int> _nodeIds;
+    std::mt19937 _gen;
+
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/core/span.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "EntityState.h"
+
+// Local port the lambda listens on for detections pushed by devices
+#define INGEST_PORT 33061
+
+// Detections are announced to the lambda over a loopback socket as they are
+// logged to the updates table, so it can block on a queue instead of polling.
+// The table stays the durable record; a dropped notification is picked up by
+// the lambda's poll of the table, which keeps running on a timer while the queue
+// reports drops.
+struct IngestFrame {
+    int32_t updateId;
+    int32_t deviceId;
+    float facialFeatures[FACE_VEC_SIZE];
+};
+
+// Bounded ring buffer of updates, many producers and one consumer
+class UpdateQueue {
+public:
+
+    UpdateQueue(size_t capacity = 4096);
+
+    // Returns false and drops the update when the queue is full
+    bool push(UpdatePtr update);
+
+    // Waits up to timeout for the first update, then takes up to max without waiting
+    size_t pop(std::vector<UpdatePtr>& updates, size_t max, std::chrono::milliseconds timeout);
+
+    size_t size();
+
+    // Updates dropped by push since the last call
+    size_t takeDropped();
+
+private:
+
+    std::vector<UpdatePtr> _ring;
+    size_t _head = 0;
+    size_t _count = 0;
+    size_t _dropped = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _ready;
+
+};
+
+class IngestServer {
+public:
+
+    IngestServer(UpdateQueue& queue, unsigned short port = INGEST_PORT);
+    ~IngestServer();
+
+    bool start();
+    void stop();
+
+private:
+
+    // Handlers run on the single io thread, one outstanding read per connection
+    void accept();
+    void read(std::shared_ptr<boost::asio::ip::tcp::socket> socket, std::shared_ptr<IngestFrame> frame);
+
+    UpdateQueue& _queue;
+    unsigned short _port;
+
+    boost::asio::io_context _ctx;
+    boost::asio::ip::tcp::acceptor _acceptor;
+    std::thread _thread;
+
+};
+
+class IngestClient {
+public:
+
+    IngestClient(unsigned short port = INGEST_PORT);
+    ~IngestClient();
+
+    bool send(int updateId, int deviceId, boost::span<const UCHAR> facialFeatures);
+
+private:
+
+    bool connect();
+
+    unsigned short _port;
+
+    boost::asio::io_context _ctx;
+    boost::asio::ip::tcp::socket _socket;
+    bool _connected = false;
+    std::chrono::steady_clock::time_point _retryAt;
+
+};
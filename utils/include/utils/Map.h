@@ -2,13 +2,64 @@
 
 #include <vector>
 #include <set>
+#include <string>
+#include <memory>
+#include <cstdint>
 
-#include <Eigen/dense>
+#include <Eigen/Dense>
 #include <glm/glm.hpp>
-#include <cinder/Shape2d.h>
-#include <cinder/Xml.h>
+#include <boost/property_tree/ptree.hpp>
 
-typedef std::vector<std::vector<int>> iGrid;
+#include "MappedFile.h"
+#include "Shape2d.h"
+
+// Steps to the target from each cell, -1 where it can't be reached and -2 where
+// it's blocked. Flat and x major: cell (x, y) is at x * height + y. Copies share
+// the cells, which are either owned or point into a mapped path map store.
+class PathMap {
+public:
+
+	PathMap() {}
+	PathMap(int width, int height, std::vector<int16_t> cells);
+	PathMap(int width, int height, const int16_t* cells, std::shared_ptr<const void> owner);
+
+	int width() const { return _width; }
+	int height() const { return _height; }
+	bool contains(int x, int y) const { return x >= 0 && x < _width && y >= 0 && y < _height; }
+	int at(int x, int y) const { return _cells[x * _height + y]; }
+	const int16_t* data() const { return _cells; }
+
+private:
+
+	int _width = 0;
+	int _height = 0;
+	const int16_t* _cells = nullptr;
+	std::shared_ptr<const void> _owner;
+
+};
+
+// Bumped whenever the layout of the path map store changes
+#define PATH_MAP_STORE_VERSION 2
+
+// Path map store: this header, then doorCount door path maps of width x height
+// int16 cells each, then the door matches as doorCount uint32 counts followed by
+// matchCount int32 device ids. Stale when mapHash no longer matches the map file.
+struct PathMapStoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint64_t mapHash;
+	uint32_t height;
+	uint32_t doorCount;
+	uint32_t matchCount;
+	uint32_t reserved;
+};
+
+// Rasterized map cell labels. CELL_OPEN is set inside an inBound and the low
+// bits index the coverage table, the devices whose view covers the cell.
+// Cells inside an outBound are 0.
+#define CELL_OPEN 0x8000
+#define CELL_COVERAGE 0x7fff
 
 struct Door {
 	int id;
@@ -22,7 +73,7 @@ struct DeviceView {
 	float angle;
 	int pair = -1;
 
-	ci::Shape2d view;
+	Shape2d view;
 
 	const float CAM_ANGLE = 60 * (M_PI / 180); // degrees
 	const float CAM_RANGE = 20; // ft
@@ -38,26 +89,60 @@ class Map {
 public:
 
 	glm::vec2 size;
-	std::vector<ci::Shape2d> inBounds;
-	std::vector<ci::Shape2d> outBounds;
+	std::vector<Shape2d> inBounds;
+	std::vector<Shape2d> outBounds;
 	std::vector<DeviceView> devs;
 	std::vector<Door> doors;
 
 	Map() {}
 	Map(std::string filename);
 
-	void generatePathMaps(std::vector<std::set<int>>& matches = std::vector<std::set<int>>(1));
+	// Both fill one path map per door / device in parallel, results are in door / device order.
+	// With matches, each door's flood stops at device views and matches gets the devices
+	// bounding it, so those path maps are only good for matching.
+	void generatePathMaps();
+	void generatePathMaps(std::vector<std::set<int>>& matches);
 	void getDeviceConnections(std::vector<std::set<int>>& conns, Eigen::MatrixXd& distances);
+	// Maps the door path maps and reads the door matches from the store named by storePath
+	// (see versionedPath), building and writing it first when it's missing
+	void loadPathMaps(const std::string& storePath);
 
-	const iGrid* getPathMap(int room) const;
-	iGrid getDevicePathMap(int dev) const;
+	// Threads used for path map generation, <= 0 uses one per hardware thread
+	static void setThreads(int threads) { _threads = threads; }
 
-private:
+	const PathMap* getPathMap(int room) const;
+	// Devices bounding each door, as generatePathMaps(matches) gives them. Filled by loadPathMaps.
+	const std::vector<std::set<int>>& getDoorMatches() const { return _doorMatches; }
+	// Filled on each call
+	PathMap getDevicePathMap(int dev) const;
 
-	ci::Shape2d makeRect(glm::vec2 topLeft, float width, float height);
-	void loadBounds(ci::XmlTree map, std::string name, std::vector<ci::Shape2d>& bounds);
-	void createPathMap(iGrid& pathMap, glm::ivec2 end, std::set<int>& boundingDevs = std::set<int>({0}), int excludeDev = -1) const;
+private:
 
-	std::vector<iGrid> _pathMaps;
+	Shape2d makeRect(glm::vec2 topLeft, float width, float height);
+	void loadBound(const boost::property_tree::ptree& bound, std::vector<Shape2d>& bounds);
+	void rasterize();
+	template<class Fn> void forEachCell(const Shape2d& shape, Fn fn) const;
+	static int poolSize(int fills);
+	void createPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end) const;
+	// Also collects the devices whose views bound the flood, other than excludeDev
+	void createPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end, std::set<int>& boundingDevs, int excludeDev = -1) const;
+	void generateDoorPathMaps(std::vector<std::set<int>>* matches);
+	void generateDoorMatches();
+	void fillPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end, std::set<int>* boundingDevs, int excludeDev) const;
+	bool mapStore(const std::string& storePath);
+	bool writeStore(const std::string& storePath) const;
+
+	uint64_t _mapHash = 0;
+	std::vector<PathMap> _pathMaps;
+	std::vector<std::set<int>> _doorMatches;
+
+	// Classified once on load, x major like the path maps (x * _gridHeight + y)
+	int _gridWidth = 0;
+	int _gridHeight = 0;
+	std::vector<uint16_t> _cells;
+	// Device indices covering a cell, in device order. Entry 0 is no devices.
+	std::vector<std::vector<int>> _coverage;
+
+	static int _threads;
 
 };
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Helpers for binary caches that are memory mapped and used in place.
+
+// FNV-1a of the file contents, 0 if it can't be read
+uint64_t hashFile(const std::string& path);
+
+// path with the format version and source hash added before the extension, e.g.
+// pathGraph.bin -> pathGraph.v1-<hash>.bin. A cache whose contents follow from those
+// two gets a new name when they change, so a file another process still has mapped,
+// which Windows won't let be replaced, never needs to be written over.
+std::string versionedPath(const std::string& path, uint32_t version, uint64_t hash);
+// Best effort removal of the versions of path other than keep, skipping any still in use
+void removeOtherVersions(const std::string& path, const std::string& keep);
+
+// Writes to a temporary file then renames it over path, so readers never map
+// a half written cache. The rename is retried for a while in case path is briefly
+// held open, failures are reported on stderr.
+bool replaceFile(const std::string& path, const std::vector<char>& bytes);
+// Same, streaming whatever write puts out instead of holding the file in memory.
+// write returns false to abandon the file.
+bool replaceFile(const std::string& path, const std::function<bool(std::ostream&)>& write);
+
+// Whole file mapped read only. Several processes mapping the same cache share
+// its pages.
+class MappedFile {
+public:
+
+    MappedFile(const std::string& path);
+
+    bool valid() const { return _valid; }
+    const char* data() const { return static_cast<const char*>(_region.get_address()); }
+    size_t size() const { return _region.get_size(); }
+
+private:
+
+    boost::interprocess::file_mapping _file;
+    boost::interprocess::mapped_region _region;
+    bool _valid = false;
+
+};
@@ -6,13 +6,34 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <cstdint>
 
 #include <boost/core/span.hpp>
-#include <Eigen/dense>
+#include <Eigen/Dense>
 
 #include "Map.h"
+#include "MappedFile.h"
 
 typedef unsigned char UCHAR;
+
+// First word of a sparse path blob, never a real depth
+#define PATH_SPARSE_TAG INT32_MIN
+
+// Bumped whenever the layout of the binary graph cache changes
+#define PATH_GRAPH_CACHE_VERSION 1
+
+// Binary graph cache: this header, then node count + 1 CSR row offsets, the
+// edge targets, padding to 8 bytes and the column major node x node distance
+// matrix. Stale when mapHash no longer matches the map file.
+struct PathGraphCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t mapHash;
+    uint32_t edgeCount;
+    uint32_t reserved;
+};
+
 class PathGraph {
 public:
 
@@ -22,25 +43,46 @@ public:
 
     PathGraph(int stsId_, int ltsId_, int period_, boost::span<const UCHAR> path = boost::span<const UCHAR>());
 
+    // cachePath names the cache, the file used has the format version and map hash added to it
     static void initGraph(std::string mapPath, std::string cachePath);
+    // Uses the given connections directly, without a map or cache
+    static void initGraph(const std::vector<std::set<int>>& conns, const Eigen::MatrixXd& distances);
     static size_t getPathByteSize();
-    static std::set<int> getGraphEdges(int node);
+    static int getNodeCount() { return _nodeCount; }
+    // Sorted neighbours of node, valid until the graph is initialized again
+    static boost::span<const int32_t> getGraphEdges(int node);
     static double getGraphEdgeLength(int from, int to);
 
     void start(int node);
     void update(int lastNode, int nextNode);
     void fuse(std::shared_ptr<PathGraph> other);
-    int getFinalDev();
-    int getNext(int node);
+    int getFinalDev() const;
+    int getNext(int node) const;
 
 	const boost::span<UCHAR> getPathSpan() const;
+    // Blob stored in the db. Dense is every node's depth, sparse (PATH_SPARSE_ENCODING
+    // builds) is the tag followed by (node, depth) pairs for the nodes on the path, used
+    // whenever it is the smaller of the two. The constructor reads either.
+    std::vector<UCHAR> encode() const;
     const Eigen::VectorXi& getDepths() const;
-    int getDepth(int node);
+    int getDepth(int node) const;
     
 private:
 
-    static std::vector<std::set<int>> _graph;
-    static Eigen::MatrixXd _distances;
+    static bool loadCache(const std::string& cachePath, uint64_t mapHash);
+    static bool writeCache(const std::string& cachePath, uint64_t mapHash);
+
+    // The static graph in CSR form. These point into the mapped cache file when
+    // there is one, otherwise into the owned vectors below.
+    static int _nodeCount;
+    static const uint32_t* _offsets;
+    static const int32_t* _edges;
+    static const double* _distances;
+
+    static std::unique_ptr<MappedFile> _cacheFile;
+    static std::vector<uint32_t> _ownedOffsets;
+    static std::vector<int32_t> _ownedEdges;
+    static Eigen::MatrixXd _ownedDistances;
 
     Eigen::VectorXi _depths;
 
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Rect2d {
+    float x1, y1, x2, y2;
+};
+
+// Closed polygon outline standing in for ci::Shape2d, so the map geometry
+// doesn't need Cinder. Arcs are flattened into short segments as they're added.
+class Shape2d {
+public:
+
+    void moveTo(glm::vec2 point);
+    void lineTo(glm::vec2 point);
+    // Counter clockwise from startRadians to endRadians, joined to the current point by a line
+    void arc(glm::vec2 center, float radius, float startRadians, float endRadians);
+    void close() {}
+    void transform(const glm::mat3& trans);
+
+    // Even-odd rule, as Cinder's Shape2d::contains
+    bool contains(glm::vec2 point) const;
+    Rect2d calcBoundingBox() const;
+
+    const std::vector<glm::vec2>& getPoints() const { return _points; }
+
+private:
+
+    std::vector<glm::vec2> _points;
+
+};
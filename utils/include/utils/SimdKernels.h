@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Raw float loops behind the face distance and crowd step code. The scalar
+// versions are always built; the AVX2 and AVX-512 ones live in their own
+// translation units, the only ones compiled with those instruction sets. They
+// take plain pointers and include nothing from Eigen or glm, so no type or
+// inline function is seen with two layouts across the build. The variant is
+// picked once at runtime from what the CPU supports.
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+// Crowd's arrays as the step kernels see them, see Crowd.h
+struct CrowdArrays {
+    float* x;
+    float* y;
+    float* heading;
+    const int32_t* target;
+    // door * width * height + x * height + y, padded for a 4 byte gather at the last cell
+    const uint8_t* flow;
+    int width;
+    int height;
+    // step and heading of each of the 8 flow directions, stop marks cells with nowhere to go
+    const float* dirX;
+    const float* dirY;
+    const float* dirHeading;
+    int stop;
+};
+
+struct SimdKernels {
+    SimdLevel level;
+    // out[i] += (row[i] - q)^2 for i in [0, n)
+    void (*accumulateSquaredDiff)(const float* row, float q, float* out, int n);
+    // out[c] = a . column c for the cols columns of a feature major panel, consecutive
+    // features of a column stride floats apart
+    void (*dotTile)(const float* a, const float* panel, size_t stride, int cols, int features, float* out);
+    // Steps agents [begin, end) dt along their flow and returns the first it didn't step,
+    // the rest is left to the caller's scalar loop
+    int (*crowdStep)(const CrowdArrays& crowd, int begin, int end, float dt);
+};
+
+// Best kernels both the build and the CPU support
+const SimdKernels& simdKernels();
+const char* simdLevelName(SimdLevel level);
+
+// The per instruction set tables, null when that file isn't in the build. Kernels a
+// level doesn't speed up are null in its table.
+const SimdKernels* scalarKernels();
+const SimdKernels* avx2Kernels();
+const SimdKernels* avx512Kernels();
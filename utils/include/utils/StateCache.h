@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <shared_mutex>
+
+#include "EntityState.h"
+#include "DBConnection.h"
+#include "UnitOfWork.h"
+#include "FaceDistance.h"
+#include "FaceIndex.h"
+
+// Resident copy of the short and long term state tables.
+// States are loaded once and kept in memory; changes apply to the resident copy
+// at once and reach the db with the caller's unit of work, which reverts the
+// states it touched if it rolls back. The cache reloads itself whenever the state
+// epoch in globals changes, which the server bumps after rewriting the state tables.
+// Readers hold readLock() while using the state lists, means or index.
+class StateCache {
+public:
+
+    StateCache(FaceIndexType indexType = BRUTE_FORCE_INDEX);
+
+    void sync(DBConnection& db, int epoch);
+    void invalidate();
+    void setIndexType(FaceIndexType indexType);
+
+    std::shared_lock<std::shared_mutex> readLock() const { return std::shared_lock<std::shared_mutex>(_mutex); }
+
+    const std::vector<ShortTermStatePtr>& getShortTermStates() const { return _shortTermStates; }
+    const std::vector<LongTermStatePtr>& getLongTermStates() const { return _longTermStates; }
+    LongTermStatePtr getLongTermState(int id) const;
+
+    // Means laid out for the batched distance kernels, column i matches state i
+    const FaceMatrix& getShortTermMeans() const { return _shortTermMeans; }
+    const FaceIndex& getLongTermIndex() const { return *_longTermIndex; }
+
+    void addShortTermState(ShortTermStatePtr sts);
+    void commitShortTermState(DBConnection& db, ShortTermStatePtr sts);
+    // Updates the resident copy now and leaves the row write to the unit of work
+    void commitShortTermState(UnitOfWork& work, ShortTermStatePtr sts);
+    // Puts back a state whose unit of work rolled back, previous being its copy from before
+    void revertShortTermState(ShortTermStatePtr sts, const ShortTermState& previous);
+
+private:
+
+    void load(DBConnection& db);
+    void updateMean(ShortTermStatePtr sts);
+
+    mutable std::shared_mutex _mutex;
+
+    bool _loaded = false;
+    int _epoch = -1;
+
+    std::vector<ShortTermStatePtr> _shortTermStates;
+    std::vector<LongTermStatePtr> _longTermStates;
+    std::map<int, LongTermStatePtr> _longTermStatesById;
+    std::map<int, int> _shortTermIndex;
+
+    FaceMatrix _shortTermMeans;
+    FaceIndexPtr _longTermIndex;
+
+};
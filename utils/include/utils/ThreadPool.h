@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads pulling tasks off a shared queue.
+class ThreadPool {
+public:
+
+    // threads <= 0 uses one thread per hardware thread
+    ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    int size() const { return _threads.size(); }
+
+    void submit(std::function<void()> task);
+    void wait();
+
+    // Runs fn(i) for i in [0, n) across the pool and the calling thread and blocks
+    // until those are done. Safe to call from a pool task.
+    void parallelFor(int n, const std::function<void(int)>& fn);
+
+    // Index of the calling pool thread, -1 off the pool
+    static int workerIndex();
+
+private:
+
+    void work(int index);
+
+    std::vector<std::thread> _threads;
+    std::queue<std::function<void()>> _tasks;
+
+    std::mutex _mutex;
+    std::condition_variable _taskReady;
+    std::condition_variable _idle;
+    int _active = 0;
+    bool _stopping = false;
+
+};
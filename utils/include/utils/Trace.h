@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "EntityState.h"
+#include "Ingest.h"
+#include "MappedFile.h"
+
+// Bumped whenever the trace record layout changes
+#define TRACE_VERSION 1
+
+// Detection trace: this header then one TraceRecord per detection in the order
+// they were pushed. Times are simulated, so the same run records the same trace.
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t featureSize;
+};
+
+struct TraceRecord {
+    int64_t timeUs;
+    int32_t deviceId;
+    int32_t reserved;
+    float facialFeatures[FACE_VEC_SIZE];
+};
+
+class TraceWriter {
+public:
+
+    TraceWriter(const std::string& path);
+
+    bool valid() const { return _file.good(); }
+
+    // Records the detections pushed at simulated time timeUs
+    void write(int64_t timeUs, const std::vector<UpdatePtr>& updates);
+    void flush();
+
+private:
+
+    std::mutex _mutex;
+    std::ofstream _file;
+
+};
+
+class TraceReader {
+public:
+
+    TraceReader(const std::string& path);
+
+    bool valid() const { return _records != nullptr; }
+    size_t size() const { return _count; }
+    const TraceRecord& operator[](size_t i) const { return _records[i]; }
+
+private:
+
+    MappedFile _file;
+    const TraceRecord* _records = nullptr;
+    size_t _count = 0;
+
+};
+
+// Feeds a trace into an update queue on its own thread, as the ingest server
+// would. speed scales the recorded gaps, <= 0 pushes as fast as the queue takes
+// them. Replayed updates get ids -1, -2, ... so they are never marked in the
+// updates table.
+class TraceReplay {
+public:
+
+    TraceReplay(const std::string& path, UpdateQueue& queue, double speed = 1.0);
+    ~TraceReplay();
+
+    bool start();
+    void stop();
+
+    bool done() const { return _done; }
+    size_t size() const { return _trace.size(); }
+    // When the update with this (negative) id was queued
+    std::chrono::steady_clock::time_point queuedAt(int updateId) const { return _queuedAt[-updateId - 1]; }
+
+private:
+
+    TraceReader _trace;
+    UpdateQueue& _queue;
+    double _speed;
+
+    std::vector<std::chrono::steady_clock::time_point> _queuedAt;
+    std::thread _thread;
+    std::atomic<bool> _stopping = false;
+    std::atomic<bool> _done = false;
+
+};
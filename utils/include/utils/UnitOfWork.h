@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+
+#include "DBConnection.h"
+#include "EntityState.h"
+#include "PathGraph.h"
+
+// Collects the writes made while processing one or more updates and applies
+// them in a single transaction. Inserts whose ids are needed straight away
+// (new states, particles) run through db() inside the transaction; row
+// rewrites are deferred, deduplicated and written in id order on commit so
+// concurrent units lock rows in the same order. Anything left uncommitted is
+// rolled back when the unit goes out of scope.
+class UnitOfWork {
+public:
+
+    UnitOfWork(DBConnection& db);
+    ~UnitOfWork();
+
+    bool begin();
+
+    DBConnection& db() { return _db; }
+
+    void updateShortTermState(ShortTermStatePtr sts);
+    void updatePath(PathGraphPtr path);
+    void addParticleTime(Particle particle, int deviceId, TimePoint expectedTime);
+    // Records which sts the update went to, updates that were never logged are skipped
+    void markUpdate(UpdatePtr update);
+
+    // Writes everything deferred and commits. Returns false and rolls back if
+    // any statement since begin() failed.
+    bool commit();
+    void rollback();
+
+private:
+
+    DBConnection& _db;
+    bool _active = false;
+    long long _errorsAtBegin = 0;
+
+    std::map<int, ShortTermStatePtr> _shortTermStates;
+    // keyed by (sts id, lts id, period), one side is always -1
+    std::map<std::tuple<int, int, int>, PathGraphPtr> _paths;
+    std::map<int, UpdatePtr> _updates;
+    InsertBatch _particleTimes;
+
+};
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+
+#include "utils/Crowd.h"
+#include "utils/SimdKernels.h"
+
+// Agents per task, a multiple of the vector width so only the last block has a scalar tail
+#define CROWD_BLOCK 4096
+// Flow field entry for cells with nowhere to go
+#define FLOW_STOP 8
+// Bytes past the last cell a gather of one int may read
+#define FLOW_PADDING 3
+
+// The eight neighbours in scan order, ties go to the first
+static const int NEIGHBOURS[8][2] = { {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1} };
+
+struct FlowDirections {
+    alignas(32) float x[8];
+    alignas(32) float y[8];
+    alignas(32) float heading[8];
+
+    FlowDirections() {
+        for (int d = 0; d < 8; d++) {
+            glm::vec2 dir = glm::normalize(glm::vec2(NEIGHBOURS[d][0], NEIGHBOURS[d][1]));
+            x[d] = dir.x;
+            y[d] = dir.y;
+            heading[d] = atan2f(dir.y, dir.x);
+        }
+    }
+};
+
+static const FlowDirections DIRECTIONS;
+
+// Steepest descent from each cell, straight steps win close ties over diagonals
+static void fillFlow(const PathMap& pathMap, uint8_t* flow) {
+    for (int x = 0; x < pathMap.width(); x++) {
+        for (int y = 0; y < pathMap.height(); y++) {
+            int current = pathMap.at(x, y);
+            if (current == 0) continue;
+            if (current == -2) {
+                current = 1e3;
+            }
+            int best = FLOW_STOP;
+            float step = 0.0;
+            for (int d = 0; d < 8; d++) {
+                int nx = x + NEIGHBOURS[d][0];
+                int ny = y + NEIGHBOURS[d][1];
+                if (!pathMap.contains(nx, ny) || pathMap.at(nx, ny) == -2) continue;
+                if (current - pathMap.at(nx, ny) > step) {
+                    best = d;
+                    step = current - pathMap.at(nx, ny);
+                    if (NEIGHBOURS[d][0] * NEIGHBOURS[d][1] == 0) {
+                        step += 0.1;
+                    }
+                }
+            }
+            flow[x * pathMap.height() + y] = best;
+        }
+    }
+}
+
+void Crowd::setMap(const Map& map, ThreadPool& pool) {
+    int doors = map.doors.size();
+    if (doors == 0) return;
+    _width = map.getPathMap(0)->width();
+    _height = map.getPathMap(0)->height();
+    size_t cells = (size_t)_width * _height;
+    _flow.assign(doors * cells + FLOW_PADDING, FLOW_STOP);
+    pool.parallelFor(doors, [&](int door) { fillFlow(*map.getPathMap(door), _flow.data() + door * cells); });
+}
+
+void Crowd::resize(int size) {
+    _x.resize(size, 0.0f);
+    _y.resize(size, 0.0f);
+    _heading.resize(size, 0.0f);
+    _target.resize(size, -1);
+}
+
+const char* Crowd::kernel() {
+    return simdKernels().crowdStep == scalarKernels()->crowdStep ? "scalar" : "avx2";
+}
+
+void Crowd::step(float dt, ThreadPool& pool) {
+    if (_flow.empty()) return;
+    int n = size();
+    int blocks = (n + CROWD_BLOCK - 1) / CROWD_BLOCK;
+    pool.parallelFor(blocks, [&](int block) {
+        stepBlock(block * CROWD_BLOCK, std::min(n, (block + 1) * CROWD_BLOCK), dt);
+    });
+}
+
+void Crowd::stepBlock(int begin, int end, float dt) {
+    int cells = _width * _height;
+    CrowdArrays crowd = { _x.data(), _y.data(), _heading.data(), _target.data(), _flow.data(), _width, _height,
+        DIRECTIONS.x, DIRECTIONS.y, DIRECTIONS.heading, FLOW_STOP };
+    int i = simdKernels().crowdStep(crowd, begin, end, dt);
+    for (; i < end; i++) {
+        int door = _target[i];
+        int x = (int)std::floor(_x[i] + 0.5f);
+        int y = (int)std::floor(_y[i] + 0.5f);
+        if (door < 0 || x < 0 || x >= _width || y < 0 || y >= _height) continue;
+        int dir = _flow[(size_t)door * cells + x * _height + y];
+        if (dir == FLOW_STOP) continue;
+        _x[i] += DIRECTIONS.x[dir] * dt;
+        _y[i] += DIRECTIONS.y[dir] * dt;
+        _heading[i] = DIRECTIONS.heading[dir];
+    }
+}
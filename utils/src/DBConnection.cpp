@@ -1,10 +1,15 @@
 
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <atomic>
 
 #include <boost/mysql/error_with_diagnostics.hpp>
 #include <boost/mysql/handshake_params.hpp>
 #include <boost/mysql/results.hpp>
+#include <boost/mysql/common_server_errc.hpp>
+#include <boost/mysql/mysql_server_errc.hpp>
+#include <boost/asio/error.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/core/span.hpp>
 
@@ -12,22 +17,37 @@
 
 #include "utils/DBConnection.h"
 
-DBConnection::DBConnection() : _ssl_ctx(boost::asio::ssl::context::tls_client), _conn(_ctx, _ssl_ctx) {}
+DBConnection::DBConnection() : _ssl_ctx(boost::asio::ssl::context::tls_client) {}
 
 DBConnection::~DBConnection() {
-    _conn.close();
+    if (_healthy) {
+        try {
+            _conn->close();
+        }
+        catch (const std::exception&) {}
+    }
 }
 
 bool DBConnection::connect() {
-    static bool logged = false;
+    // pool connections connect from several threads at once, only the first success is announced
+    static std::atomic<bool> logged(false);
+    bool announce = !logged.load();
+    _healthy = false;
+    _inTransaction = false;
     try {
         boost::asio::ip::tcp::resolver resolver(_ctx.get_executor());
         auto endpoints = resolver.resolve("127.0.0.1", boost::mysql::default_port_string);
         boost::mysql::handshake_params params("root", "", "test", boost::mysql::handshake_params::default_collation, boost::mysql::ssl_mode::enable);
 
-        if (!logged) std::cout << "Connecting to mysql server at " << endpoints.begin()->endpoint() << " ... ";
+        if (announce) std::cout << "Connecting to mysql server at " << endpoints.begin()->endpoint() << " ... ";
 
-        _conn.connect(*endpoints.begin(), params);
+        // statements belong to the old session, keep their stats but prepare them again
+        for (auto& entry : _statements) {
+            entry.second.statement = boost::mysql::statement();
+        }
+        // an ssl stream can't be reused once it has been closed or broken
+        _conn = std::unique_ptr<boost::mysql::tcp_ssl_connection>(new boost::mysql::tcp_ssl_connection(_ctx, _ssl_ctx));
+        _conn->connect(*endpoints.begin(), params);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -38,28 +58,253 @@ bool DBConnection::connect() {
         std::cerr << "Error: " << err.what() << std::endl;
         return false;
     }
+    _healthy = true;
+    _backoff = std::chrono::milliseconds(0);
+    _lastUsed = std::chrono::steady_clock::now();
     boost::mysql::results r;
     query("SET time_zone = '+00:00'", r);
-    if (!logged) { logged = true; printf("Connected\n"); }
+    _consecutiveIds = query("SELECT CAST(@@innodb_autoinc_lock_mode AS SIGNED)", r) && !r.rows().empty() && r.rows()[0][0].as_int64() != 2;
+    if (!_consecutiveIds && announce) {
+        printf("innodb_autoinc_lock_mode is interleaved, batches needing ids are inserted row by row\n");
+    }
+    if (announce && !logged.exchange(true)) printf("Connected\n");
     return true;
 }
 
+bool DBConnection::reconnect() {
+    auto now = std::chrono::steady_clock::now();
+    if (now < _retryAt) return false;
+    fmt::println("Reconnecting to mysql server ... ");
+    if (_healthy) {
+        try {
+            _conn->close();
+        }
+        catch (const std::exception&) {}
+    }
+    if (connect()) {
+        return true;
+    }
+    // back off exponentially so a downed server isn't hammered by every caller
+    _backoff = std::min(std::max(_backoff * 2, std::chrono::milliseconds(DB_RECONNECT_MIN_MS)), std::chrono::milliseconds(DB_RECONNECT_MAX_MS));
+    _retryAt = now + _backoff;
+    fmt::println("Reconnect failed, retrying in {} ms", _backoff.count());
+    return false;
+}
+
+bool DBConnection::ping() {
+    if (!_healthy) return false;
+    try {
+        _conn->ping();
+        _lastUsed = std::chrono::steady_clock::now();
+    }
+    catch (const boost::mysql::error_with_diagnostics& err) {
+        noteError(err);
+    }
+    catch (const std::exception&) {
+        _healthy = false;
+    }
+    return _healthy;
+}
+
+void DBConnection::ensureConnected() {
+    // a new session would silently run the rest of a transaction as autocommits
+    if (!_healthy && (_inTransaction || !reconnect())) {
+        throw boost::mysql::error_with_diagnostics(boost::asio::error::not_connected, boost::mysql::diagnostics());
+    }
+    _lastUsed = std::chrono::steady_clock::now();
+}
+
+void DBConnection::noteError(const boost::mysql::error_with_diagnostics& err) {
+    _errors++;
+    // errors reported by the server leave the session usable, anything else
+    // (network, tls, protocol) means the connection is gone
+    const boost::system::error_category& category = err.code().category();
+    if (category != boost::mysql::get_common_server_category() && category != boost::mysql::get_mysql_server_category()) {
+        _healthy = false;
+    }
+}
+
 bool DBConnection::query(const char* sql, boost::mysql::results &result) {
     try {
-        _conn.execute(sql, result);
+        ensureConnected();
+        _conn->execute(sql, result);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
+        noteError(err);
         std::cerr << "Error: " << err.what() << '\n'
             << "Server diagnostics: " << err.get_diagnostics().server_message() << std::endl;
         return false;
     }
     catch (const std::exception& err) {
+        _healthy = false;
+        _errors++;
         std::cerr << "Error: " << err.what() << std::endl;
         return false;
     }
     return true;
 }
 
+bool DBConnection::beginTransaction() {
+    boost::mysql::results result;
+    if (!query("START TRANSACTION", result)) return false;
+    _inTransaction = true;
+    return true;
+}
+
+bool DBConnection::commitTransaction() {
+    boost::mysql::results result;
+    bool committed = query("COMMIT", result);
+    _inTransaction = false;
+    return committed;
+}
+
+void DBConnection::rollbackTransaction() {
+    boost::mysql::results result;
+    if (_healthy) query("ROLLBACK", result);
+    _inTransaction = false;
+}
+
+DBConnection::CachedStatement& DBConnection::prepare(const char* sql) {
+    CachedStatement& cached = _statements[sql];
+    if (!cached.statement.valid()) {
+        cached.statement = _conn->prepare_statement(sql);
+        cached.stats.sql = sql;
+    }
+    return cached;
+}
+
+void DBConnection::recordExecution(CachedStatement& cached, std::chrono::steady_clock::time_point start) {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cached.stats.executions++;
+    cached.stats.totalMs += ms;
+    cached.stats.maxMs = std::max(cached.stats.maxMs, ms);
+}
+
+bool DBConnection::isStaleStatement(const boost::mysql::error_with_diagnostics& err) {
+    return err.code() == boost::mysql::common_server_errc::er_unknown_stmt_handler;
+}
+
+void DBConnection::getStatementStats(std::vector<StatementStats>& stats) {
+    for (const auto& entry : _statements) {
+        stats.push_back(entry.second.stats);
+    }
+}
+
+void DBConnection::printStatementStats() {
+    std::vector<StatementStats> stats;
+    getStatementStats(stats);
+    printStatementStats(stats);
+}
+
+void DBConnection::printStatementStats(const std::vector<StatementStats>& stats) {
+    // stats gathered from several connections are merged by statement
+    std::unordered_map<std::string, StatementStats> merged;
+    for (const StatementStats& stat : stats) {
+        StatementStats& total = merged[stat.sql];
+        total.sql = stat.sql;
+        total.executions += stat.executions;
+        total.totalMs += stat.totalMs;
+        total.maxMs = std::max(total.maxMs, stat.maxMs);
+    }
+    std::vector<StatementStats> sorted;
+    for (const auto& entry : merged) {
+        sorted.push_back(entry.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const StatementStats& a, const StatementStats& b) {
+        return a.totalMs > b.totalMs;
+    });
+    fmt::println("{:>10} {:>12} {:>10} {:>10}  {}", "executions", "total (ms)", "avg (ms)", "max (ms)", "statement");
+    for (const StatementStats& stat : sorted) {
+        fmt::println("{:>10} {:>12.1f} {:>10.3f} {:>10.3f}  {:.80}", stat.executions, stat.totalMs,
+            stat.executions > 0 ? stat.totalMs / stat.executions : 0.0, stat.maxMs, stat.sql);
+    }
+}
+
+void DBConnection::resetStatementStats() {
+    for (auto& entry : _statements) {
+        entry.second.stats = StatementStats{ entry.second.stats.sql };
+    }
+}
+
+bool DBConnection::flush(InsertBatch& batch, std::vector<int>* ids) {
+    if (batch.empty()) return true;
+    size_t columns = batch._columns.size();
+    std::vector<boost::mysql::field_view> params(batch._values.begin(), batch._values.end());
+    // interleaved auto increment locking can hand one statement's rows gaps, only
+    // single row inserts have a known id then
+    size_t maxRows = ids != nullptr && !_consecutiveIds ? 1 : batch._maxRows;
+    size_t row = 0;
+    bool ok = true;
+    try {
+        while (row < batch._rows) {
+            // power of two chunks keep the number of distinct statements per table small
+            size_t chunk = 1;
+            while (chunk * 2 <= batch._rows - row && chunk * 2 <= maxRows) {
+                chunk *= 2;
+            }
+            std::string sql = batch.sql(chunk);
+            auto first = params.begin() + row * columns;
+            auto last = first + chunk * columns;
+            boost::mysql::results result;
+            run(sql.c_str(), result, [&](const boost::mysql::statement& statement) { return statement.bind(first, last); });
+            // a single multi-row insert gets consecutive auto increment ids starting at last_insert_id
+            if (ids != nullptr) {
+                for (size_t i = 0; i < chunk; i++) {
+                    ids->push_back(result.last_insert_id() + i);
+                }
+            }
+            row += chunk;
+        }
+    }
+    catch (const boost::mysql::error_with_diagnostics& err) {
+        // run has counted the error
+        std::cerr << "Error: " << err.what() << '\n'
+            << "Server diagnostics: " << err.get_diagnostics().server_message() << '\n'
+            << "Dropped " << batch._rows - row << " of " << batch._rows << " rows for " << batch._table << std::endl;
+        ok = false;
+    }
+    if (ids != nullptr) {
+        // rows that didn't make it in still get a slot so ids line up with the batch
+        ids->resize(ids->size() + batch._rows - row, -1);
+    }
+    batch.clear();
+    return ok;
+}
+
+bool DBConnection::flushIfDue(InsertBatch& batch) {
+    if (!batch.due()) return false;
+    flush(batch);
+    return true;
+}
+
+InsertBatch::InsertBatch(std::string table, std::vector<std::string> columns, size_t maxRows, std::chrono::milliseconds maxAge)
+    : _table(table), _columns(columns), _maxRows(std::max<size_t>(1, maxRows)), _maxAge(maxAge) {}
+
+bool InsertBatch::due() const {
+    return _rows >= _maxRows || (_rows > 0 && std::chrono::steady_clock::now() - _firstAdded >= _maxAge);
+}
+
+void InsertBatch::clear() {
+    _values.clear();
+    _rows = 0;
+}
+
+std::string InsertBatch::sql(size_t rows) const {
+    std::string placeholders = "(";
+    std::string columns = "(";
+    for (int i = 0; i < _columns.size(); i++) {
+        placeholders += i == 0 ? "?" : ", ?";
+        columns += (i == 0 ? "" : ", ") + _columns[i];
+    }
+    placeholders += ")";
+    columns += ")";
+    std::string sql = fmt::format("INSERT INTO {} {} VALUES {}", _table, columns, placeholders);
+    for (size_t i = 1; i < rows; i++) {
+        sql += ", " + placeholders;
+    }
+    return sql;
+}
+
 void DBConnection::createTables() {
 
     printf("Checking tables ... ");
@@ -68,8 +313,14 @@ void DBConnection::createTables() {
 
     query("CREATE TABLE IF NOT EXISTS globals (\
         period INT, \
+        epoch INT DEFAULT 0, \
         UNIQUE KEY globals_uidx (period)\
     )", r);
+    // globals tables from before the state epoch don't get it from CREATE TABLE IF NOT EXISTS
+    if (query("SELECT COUNT(*) FROM information_schema.columns WHERE table_schema = DATABASE() AND table_name = 'globals' AND column_name = 'epoch'", r)
+        && !r.rows().empty() && r.rows()[0][0].as_int64() == 0) {
+        query("ALTER TABLE globals ADD COLUMN epoch INT DEFAULT 0", r);
+    }
     query("CREATE TABLE IF NOT EXISTS students (\
         id INT AUTO_INCREMENT PRIMARY KEY\
     )", r);
@@ -95,7 +346,7 @@ void DBConnection::createTables() {
     )", r);
 
     const int face_bytes = FACE_VEC_SIZE * 4;
-    const int face_cov_bytes = FACE_VEC_SIZE * FACE_VEC_SIZE * 4;
+    const int face_cov_bytes = sizeof(FFCov);
     query(fmt::format("CREATE TABLE IF NOT EXISTS long_term_states (\
         id INT AUTO_INCREMENT PRIMARY KEY, \
         mean_facial_features BLOB({}), \
@@ -157,7 +408,7 @@ void DBConnection::clearTables() {
     printf("Clearing tables ... ");
     boost::mysql::results r;
 	query("SET FOREIGN_KEY_CHECKS = 0", r);
-    query("TRUNCATE globals", r);
+    // globals is kept so initGlobals can count the state epoch on
     query("TRUNCATE attendance", r);
     query("TRUNCATE facial_data", r);
     query("TRUNCATE long_term_states", r);
@@ -176,14 +427,14 @@ void DBConnection::getEntities(std::vector<EntityPtr>& vec) {
     printf("Loading entities ... ");
     try {
         boost::mysql::results result;
-        _conn.execute("SELECT id FROM students", result);
+        execute("SELECT id FROM students", result);
         if (!result.empty()) {
             for (const boost::mysql::row_view& row : result.rows()) {
                 int id = row.at(0).as_int64();
 
                 std::vector<int> schedule;
                 //boost::mysql::results scheduleResult;
-                //_conn.execute(_conn.prepare_statement("SELECT room_id FROM schedules WHERE student_id=? ORDER BY period ASC").bind(id), scheduleResult);
+                //execute("SELECT room_id FROM schedules WHERE student_id=? ORDER BY period ASC", scheduleResult, id);
                 //for (const boost::mysql::row_view& scheduleRow : scheduleResult.rows()) {
                 //    schedule.push_back(scheduleRow[0].as_int64());
                 //}
@@ -201,9 +452,9 @@ void DBConnection::getEntities(std::vector<EntityPtr>& vec) {
 bool DBConnection::getEntityFeatures(EntityPtr entity, int devId) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "SELECT facial_features FROM facial_data WHERE student_id=? AND device_id=?"
-            ).bind(entity->id, devId), result);
+        execute(
+            "SELECT facial_features FROM facial_data WHERE student_id=? AND device_id=?",
+            result, entity->id, devId);
         if (result.rows().size() > 0) {
             entity->setFacialFeatures(result.rows()[0][0].as_blob());
             return true;
@@ -220,7 +471,7 @@ void DBConnection::getEntitiesFeatures(std::vector<EntityPtr>& vec) {
     printf("Getting entities features ... ");
     try {
         boost::mysql::results result;
-        _conn.execute("SELECT student_id, facial_features FROM facial_data", result);
+        execute("SELECT student_id, facial_features FROM facial_data", result);
         if (!result.empty()) {
             for (const boost::mysql::row_view& row : result.rows()) {
                 vec.push_back(EntityPtr(new Entity(row[0].as_int64(), row[1].as_blob())));
@@ -234,11 +485,35 @@ void DBConnection::getEntitiesFeatures(std::vector<EntityPtr>& vec) {
     }
 }
 
+void DBConnection::getFacialData(std::vector<std::pair<int, UpdatePtr>>& rows) {
+    printf("Getting facial data ... ");
+    try {
+        boost::mysql::results result;
+        execute("SELECT student_id, device_id, facial_features FROM facial_data", result);
+        if (!result.empty()) {
+            rows.reserve(rows.size() + result.rows().size());
+            for (const boost::mysql::row_view& row : result.rows()) {
+                rows.push_back(std::make_pair((int)row[0].as_int64(), UpdatePtr(new Update(-1, row[1].as_int64(), row[2].as_blob()))));
+            }
+        }
+        printf("Done\n");
+    }
+    catch (const boost::mysql::error_with_diagnostics& err) {
+        std::cerr << "Error: " << err.what() << '\n'
+            << "Server diagnostics: " << err.get_diagnostics().server_message() << std::endl;
+    }
+}
+
 void DBConnection::pushUpdate(int devId, const boost::span<UCHAR> facialFeatures) {
     fmt::print("Pushing update for device {} ... ", devId);
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement("INSERT INTO updates (device_id, facial_features) VALUES(?, ?)").bind(devId, facialFeatures), result);
+        execute("INSERT INTO updates (device_id, facial_features) VALUES(?, ?)", result, devId, facialFeatures);
+        // the row is the durable record, the lambda is only notified so it doesn't have to poll
+        if (_ingest == nullptr) {
+            _ingest = std::unique_ptr<IngestClient>(new IngestClient());
+        }
+        _ingest->send(result.last_insert_id(), devId, facialFeatures);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -247,6 +522,27 @@ void DBConnection::pushUpdate(int devId, const boost::span<UCHAR> facialFeatures
     printf("Done\n");
 }
 
+void DBConnection::pushUpdates(const std::vector<UpdatePtr>& updates) {
+    if (updates.empty()) return;
+    fmt::print("Pushing {} updates ... ", updates.size());
+    InsertBatch batch("updates", { "device_id", "facial_features" });
+    for (const UpdatePtr& update : updates) {
+        batch.add(update->deviceId, update->getFacialFeatures());
+    }
+    std::vector<int> ids;
+    flush(batch, &ids);
+    if (_ingest == nullptr) {
+        _ingest = std::unique_ptr<IngestClient>(new IngestClient());
+    }
+    for (int i = 0; i < updates.size(); i++) {
+        updates[i]->id = ids[i];
+        if (ids[i] != -1) {
+            _ingest->send(ids[i], updates[i]->deviceId, updates[i]->getFacialFeatures());
+        }
+    }
+    printf("Done\n");
+}
+
 void DBConnection::getNewUpdates(std::vector<UpdatePtr>& updates) {
     //printf("Fetching updates ... ");
     boost::mysql::results result;
@@ -263,9 +559,9 @@ void DBConnection::updateUpdate(UpdatePtr update) {
     try {
         fmt::print("Updating update {} with sts id {}\n", update->id, update->shortTermStateId);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "UPDATE updates SET short_term_state_id=? WHERE id=?"
-        ).bind(update->shortTermStateId, update->id), result);
+        execute(
+            "UPDATE updates SET short_term_state_id=? WHERE id=?",
+            result, update->shortTermStateId, update->id);
         printf("Done\n");
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -277,9 +573,9 @@ void DBConnection::updateUpdate(UpdatePtr update) {
 void DBConnection::removeUpdate(UpdatePtr update) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "DELETE FROM updates WHERE id=?"
-        ).bind(update->id), result);
+        execute(
+            "DELETE FROM updates WHERE id=?",
+            result, update->id);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -290,9 +586,9 @@ void DBConnection::removeUpdate(UpdatePtr update) {
 void DBConnection::removePreviousUpdates(UpdatePtr update) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "DELETE FROM updates WHERE short_term_state_id=? AND period IS NULL"
-        ).bind(update->shortTermStateId), result);
+        execute(
+            "DELETE FROM updates WHERE short_term_state_id=? AND period IS NULL",
+            result, update->shortTermStateId);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -303,9 +599,9 @@ void DBConnection::removePreviousUpdates(UpdatePtr update) {
 void DBConnection::setUpdatesPeriod(int period) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "UPDATE updates SET period=? WHERE period IS NULL"
-        ).bind(period), result);
+        execute(
+            "UPDATE updates SET period=? WHERE period IS NULL",
+            result, period);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -316,9 +612,9 @@ void DBConnection::setUpdatesPeriod(int period) {
 void DBConnection::getUpdatesPath(int stsId, std::vector<int>& devPath) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "SELECT device_id FROM updates WHERE short_term_state_id=? ORDER BY period"
-        ).bind(stsId), result);
+        execute(
+            "SELECT device_id FROM updates WHERE short_term_state_id=? ORDER BY period",
+            result, stsId);
         for (const boost::mysql::row_view& row : result.rows()) {
             devPath.push_back(row[0].as_int64());
         }
@@ -340,12 +636,11 @@ Particle DBConnection::createParticle(int stsId, UpdatePtr update, double weight
     try {
         fmt::print("Creating particle for sts {} on device {} ... ", stsId, update->deviceId);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO particles (origin_device_id, short_term_state_id, weight) VALUES(?,?,?)"
-        ).bind(update->deviceId, stsId, weight), result);
+        execute(
+            "INSERT INTO particles (origin_device_id, short_term_state_id, weight) VALUES(?,?,?)",
+            result, update->deviceId, stsId, weight);
         Particle particle;
-        query("SELECT LAST_INSERT_ID()", result);
-        particle.id = result.rows()[0][0].as_uint64();
+        particle.id = result.last_insert_id();
         particle.originDeviceId = update->deviceId;
         particle.shortTermStateId = stsId;
         particle.weight = weight;
@@ -372,16 +667,16 @@ void DBConnection::getParticles(std::vector<Particle>& particles) {
                 particle.weight = row[3].as_float();
 
                 boost::mysql::results result2;
-                _conn.execute(_conn.prepare_statement(
-                    "SELECT device_id, expected_time FROM particle_times WHERE particle_id=? AND expected_time > CURRENT_TIMESTAMP() ORDER BY expected_time LIMIT 1"
-                ).bind(particle.id), result2);
+                execute(
+                    "SELECT device_id, expected_time FROM particle_times WHERE particle_id=? AND expected_time > CURRENT_TIMESTAMP() ORDER BY expected_time LIMIT 1",
+                    result2, particle.id);
                 if (!result2.empty() && result2.rows().size() > 0) {
                     particle.nextDeviceId = result2.rows()[0][0].as_int64();
                     particle.expectedTime = result2.rows()[0][1].as_datetime().as_time_point();
                 }
-                _conn.execute(_conn.prepare_statement(
-                    "SELECT device_id, expected_time FROM particle_times WHERE particle_id=? AND expected_time < CURRENT_TIMESTAMP() ORDER BY expected_time DESC LIMIT 1"
-                ).bind(particle.id), result2);
+                execute(
+                    "SELECT device_id, expected_time FROM particle_times WHERE particle_id=? AND expected_time < CURRENT_TIMESTAMP() ORDER BY expected_time DESC LIMIT 1",
+                    result2, particle.id);
                 if (!result2.empty() && result2.rows().size() > 0) {
                     particle.lastDeviceId = result2.rows()[0][0].as_int64();
                     particle.lastTime = result2.rows()[0][1].as_datetime().as_time_point();
@@ -415,9 +710,9 @@ void DBConnection::addParticleTime(Particle particle, int deviceId, TimePoint ex
     try {
         fmt::print("Adding particle time for particle {} for device {} ... ", particle.id, deviceId);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO particle_times (particle_id, device_id, expected_time) VALUES(?,?,?)"
-        ).bind(particle.id, deviceId, boost::mysql::datetime(expectedTime)), result);
+        execute(
+            "INSERT INTO particle_times (particle_id, device_id, expected_time) VALUES(?,?,?)",
+            result, particle.id, deviceId, boost::mysql::datetime(expectedTime));
         printf("Done\n");
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -426,13 +721,22 @@ void DBConnection::addParticleTime(Particle particle, int deviceId, TimePoint ex
     }
 }
 
+InsertBatch DBConnection::particleTimesBatch() {
+    return InsertBatch("particle_times", { "particle_id", "device_id", "expected_time" });
+}
+
+void DBConnection::addParticleTime(InsertBatch& batch, Particle particle, int deviceId, TimePoint expectedTime) {
+    batch.add(particle.id, deviceId, boost::mysql::datetime(expectedTime));
+    flushIfDue(batch);
+}
+
 LongTermStatePtr DBConnection::getLongTermState(int id) {
     try {
         printf("Fetching long term state ... ");
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "SELECT id, mean_facial_features, cov_facial_features, student_id FROM long_term_states WHERE id=?"
-        ).bind(id), result);
+        execute(
+            "SELECT id, mean_facial_features, cov_facial_features, student_id FROM long_term_states WHERE id=?",
+            result, id);
         printf("Done\n");
         auto row = result.rows()[0];
         if (row[3].is_int64()) {
@@ -450,11 +754,12 @@ LongTermStatePtr DBConnection::getLongTermState(int id) {
 void DBConnection::getLongTermStates(std::vector<LongTermStatePtr> &states) {
     printf("Fetching long term states ... ");
     boost::mysql::results result;
-    query("SELECT id, mean_facial_features, cov_facial_features FROM long_term_states ORDER BY id ASC", result);
+    query("SELECT id, mean_facial_features, cov_facial_features, student_id FROM long_term_states ORDER BY id ASC", result);
     if (!result.empty()) {
         for (const boost::mysql::row_view& row : result.rows()) {
             if (row[3].is_int64()) {
                 states.push_back(LongTermStatePtr(new LongTermState(row[0].as_int64(), row[1].as_blob(), row[2].as_blob(), row[3].as_int64())));
+                continue;
             }
             states.push_back(LongTermStatePtr(new LongTermState(row[0].as_int64(), row[1].as_blob(), row[2].as_blob())));
         }
@@ -466,12 +771,11 @@ int DBConnection::addLongTermState(LongTermStatePtr lts) {
     try {
         fmt::print("Adding long term state for entity {} ... ", lts->studentId);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO long_term_states (mean_facial_features, cov_facial_features, student_id) VALUES(?,?,?)"
-        ).bind(lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->studentId), result);
-        query("SELECT LAST_INSERT_ID()", result);
+        execute(
+            "INSERT INTO long_term_states (mean_facial_features, cov_facial_features, student_id) VALUES(?,?,?)",
+            result, lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->studentId);
         printf("Done\n");
-        return result.rows()[0][0].as_uint64();
+        return result.last_insert_id();
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -480,16 +784,24 @@ int DBConnection::addLongTermState(LongTermStatePtr lts) {
     return -1;
 }
 
+InsertBatch DBConnection::longTermStatesBatch(size_t maxRows) {
+    return InsertBatch("long_term_states", { "mean_facial_features", "cov_facial_features", "student_id" }, maxRows);
+}
+
+void DBConnection::addLongTermState(InsertBatch& batch, LongTermStatePtr lts) {
+    batch.add(lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->studentId);
+    flushIfDue(batch);
+}
+
 int DBConnection::createLongTermState(ShortTermStatePtr sts) {
     try {
         printf("Creating long term state ... ");
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO long_term_states (mean_facial_features, cov_facial_features) VALUES(?,?)"
-        ).bind(sts->getFacialFeatures(), sts->getFacialFeaturesCovSpan()), result);
-        query("SELECT LAST_INSERT_ID()", result);
+        execute(
+            "INSERT INTO long_term_states (mean_facial_features, cov_facial_features) VALUES(?,?)",
+            result, sts->getFacialFeatures(), sts->getFacialFeaturesCovSpan());
         printf("Done\n");
-        return result.rows()[0][0].as_uint64();
+        return result.last_insert_id();
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -503,13 +815,13 @@ void DBConnection::updateLongTermState(LongTermStatePtr lts) {
         fmt::print("Updating long term state {} ... ", lts->id);
         boost::mysql::results result;
         if (lts->studentId == -1) {
-            _conn.execute(_conn.prepare_statement(
-                "UPDATE long_term_states SET mean_facial_features=?, cov_facial_features=? WHERE id=?"
-            ).bind(lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->id), result);
+            execute(
+                "UPDATE long_term_states SET mean_facial_features=?, cov_facial_features=? WHERE id=?",
+                result, lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->id);
         } else {
-            _conn.execute(_conn.prepare_statement(
-                "UPDATE long_term_states SET mean_facial_features=?, cov_facial_features=?, student_id=? WHERE id=?"
-            ).bind(lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->studentId, lts->id), result);
+            execute(
+                "UPDATE long_term_states SET mean_facial_features=?, cov_facial_features=?, student_id=? WHERE id=?",
+                result, lts->getFacialFeatures(), lts->getFacialFeaturesCovSpan(), lts->studentId, lts->id);
         }
         printf("Done\n");
     }
@@ -523,9 +835,9 @@ void DBConnection::setLongTermStateStudent(LongTermStatePtr lts) {
     try {
         fmt::print("Setting {} lts to student {} ... ", lts->id, lts->studentId);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "UPDATE long_term_states SET student_id=? WHERE id=?"
-        ).bind(lts->studentId, lts->id), result);
+        execute(
+            "UPDATE long_term_states SET student_id=? WHERE id=?",
+            result, lts->studentId, lts->id);
         printf("Done\n");
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -579,10 +891,10 @@ void DBConnection::getLinkedLongTermStateIds(std::set<int>& ids) {
 ShortTermStatePtr DBConnection::getLastShortTermState(int ltsId) {
     fmt::print("Fetching last short term state with lts {} ... ", ltsId);
     boost::mysql::results result;
-    _conn.execute(_conn.prepare_statement(
+    execute(
         "SELECT id, mean_facial_features, cov_facial_features, update_count, last_update_device_id, long_term_state_key \
-        FROM short_term_states WHERE long_term_state_key=? ORDER BY last_update_time DESC LIMIT 1"
-        ).bind(ltsId), result);
+        FROM short_term_states WHERE long_term_state_key=? ORDER BY last_update_time DESC LIMIT 1",
+        result, ltsId);
     if (!result.empty()) {
         for (const boost::mysql::row_view& row : result.rows()) {
             printf("Done\n");
@@ -597,17 +909,16 @@ ShortTermStatePtr DBConnection::createShortTermState(UpdateCPtr update, LongTerm
         printf("Creating short term state ... ");
         boost::mysql::results result;
         if (ltState != nullptr) {
-            _conn.execute(_conn.prepare_statement(
-                "INSERT INTO short_term_states (mean_facial_features, cov_facial_features, update_count, last_update_device_id, long_term_state_key) VALUES(?,?,?,?,?)"
-            ).bind(update->getFacialFeatures(), update->getFacialFeaturesCovSpan(), 1, update->deviceId, ltState->id), result);
+            execute(
+                "INSERT INTO short_term_states (mean_facial_features, cov_facial_features, update_count, last_update_device_id, long_term_state_key) VALUES(?,?,?,?,?)",
+                result, update->getFacialFeatures(), update->getFacialFeaturesCovSpan(), 1, update->deviceId, ltState->id);
         } else {
-            _conn.execute(_conn.prepare_statement(
-                "INSERT INTO short_term_states (mean_facial_features, cov_facial_features, update_count, last_update_device_id) VALUES(?,?,?,?)"
-            ).bind(update->getFacialFeatures(), update->getFacialFeaturesCovSpan(), 1, update->deviceId), result);
+            execute(
+                "INSERT INTO short_term_states (mean_facial_features, cov_facial_features, update_count, last_update_device_id) VALUES(?,?,?,?)",
+                result, update->getFacialFeatures(), update->getFacialFeaturesCovSpan(), 1, update->deviceId);
         }
-        query("SELECT LAST_INSERT_ID()", result);
         printf("Done\n");
-        int stsId = result.rows()[0][0].as_uint64();
+        int stsId = result.last_insert_id();
         return ShortTermStatePtr(new ShortTermState(stsId, update->getFacialFeatures(), update->getFacialFeaturesCovSpan(), 1, update->deviceId));
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -622,13 +933,13 @@ void DBConnection::updateShortTermState(ShortTermStatePtr state) {
         printf("Updating short term state ... ");
         boost::mysql::results result;
         if (state->longTermStateKey != -1) {
-            _conn.execute(_conn.prepare_statement(
-                "UPDATE short_term_states SET mean_facial_features=?, cov_facial_features=?, update_count=?, last_update_device_id=?, long_term_state_key=? WHERE id=?"
-            ).bind(state->getFacialFeatures(), state->getFacialFeaturesCovSpan(), state->updateCount, state->lastUpdateDeviceId, state->longTermStateKey, state->id), result);
+            execute(
+                "UPDATE short_term_states SET mean_facial_features=?, cov_facial_features=?, update_count=?, last_update_device_id=?, long_term_state_key=? WHERE id=?",
+                result, state->getFacialFeatures(), state->getFacialFeaturesCovSpan(), state->updateCount, state->lastUpdateDeviceId, state->longTermStateKey, state->id);
         } else {
-            _conn.execute(_conn.prepare_statement(
-                "UPDATE short_term_states SET mean_facial_features=?, cov_facial_features=?, update_count=?, last_update_device_id=? WHERE id=?"
-            ).bind(state->getFacialFeatures(), state->getFacialFeaturesCovSpan(), state->updateCount, state->lastUpdateDeviceId, state->id), result);
+            execute(
+                "UPDATE short_term_states SET mean_facial_features=?, cov_facial_features=?, update_count=?, last_update_device_id=? WHERE id=?",
+                result, state->getFacialFeatures(), state->getFacialFeaturesCovSpan(), state->updateCount, state->lastUpdateDeviceId, state->id);
         }
         printf("Done\n");
     }
@@ -649,9 +960,7 @@ PathGraphPtr DBConnection::getPath(ShortTermStatePtr sts, int period, bool silen
     try {
         if (!silent) fmt::print("Getting path for sts {} period {} ... ", sts->id, period);
         boost::mysql::results result;
-        boost::mysql::statement stmt = _conn.prepare_statement( "SELECT path FROM paths WHERE short_term_state_key=? AND period=?");
-        _conn.execute(stmt.bind(sts->id, period), result);
-        _conn.close_statement(stmt);
+        execute("SELECT path FROM paths WHERE short_term_state_key=? AND period=?", result, sts->id, period);
        if (!silent) printf("Done\n");
         if (result.rows().size() > 0) {
             return PathGraphPtr(new PathGraph(sts->id, -1, period, result.rows()[0][0].as_blob()));
@@ -669,9 +978,7 @@ PathGraphPtr DBConnection::getPath(ShortTermStatePtr sts, int period, bool silen
 PathGraphPtr DBConnection::getLtsPath(int ltsId, int period) {
     try {
         boost::mysql::results result;
-        boost::mysql::statement stmt = _conn.prepare_statement( "SELECT path FROM paths WHERE long_term_state_key=? AND period=?");
-        _conn.execute(stmt.bind(ltsId, period), result);
-        _conn.close_statement(stmt);
+        execute("SELECT path FROM paths WHERE long_term_state_key=? AND period=?", result, ltsId, period);
         if (result.rows().size() > 0) {
             return PathGraphPtr(new PathGraph(-1, ltsId, period, result.rows()[0][0].as_blob()));
         } else {
@@ -690,9 +997,7 @@ PathGraphPtr DBConnection::getPath(LongTermStatePtr lts, int period) {
     try {
         fmt::print("Getting path for lts {} period {} ... ", lts->id, period);
         boost::mysql::results result;
-        boost::mysql::statement stmt = _conn.prepare_statement( "SELECT path FROM paths WHERE long_term_state_key=? AND period=?");
-        _conn.execute(stmt.bind(lts->id, period), result);
-        _conn.close_statement(stmt);
+        execute("SELECT path FROM paths WHERE long_term_state_key=? AND period=?", result, lts->id, period);
         printf("Done\n");
         if (result.rows().size() > 0) {
             return PathGraphPtr(new PathGraph(-1, lts->id, period, result.rows()[0][0].as_blob()));
@@ -710,9 +1015,9 @@ PathGraphPtr DBConnection::getPath(LongTermStatePtr lts, int period) {
 void DBConnection::getPaths(ShortTermStatePtr sts, std::vector<PathGraphPtr>& paths) {
     boost::mysql::results result;
     fmt::print("Fetching paths for sts {} ... ", sts->id);
-    _conn.execute(_conn.prepare_statement(
-        "SELECT period, path FROM paths WHERE short_term_state_key=? ORDER BY period ASC"
-    ).bind(sts->id), result);
+    execute(
+        "SELECT period, path FROM paths WHERE short_term_state_key=? ORDER BY period ASC",
+        result, sts->id);
     if (!result.empty()) {
         for (const boost::mysql::row_view& row : result.rows()) {
             paths.push_back(PathGraphPtr(new PathGraph(sts->id, -1, row[0].as_int64(), row[1].as_blob())));
@@ -726,34 +1031,17 @@ void DBConnection::updatePath(PathGraphPtr path) {
     try {
         printf("Updating path ... ");
         boost::mysql::results result;
+        // (period, state) is unique, so an upsert replaces the select then update or insert
+        std::vector<UCHAR> blob = path->encode();
+        boost::mysql::blob_view pathBlob(blob.data(), blob.size());
         if (path->shortTermStateId != -1) {
-            _conn.execute(_conn.prepare_statement(
-                "SELECT id FROM paths WHERE period=? AND short_term_state_key=?"
-            ).bind(path->period, path->shortTermStateId), result);
-            if (result.rows().size() > 0) {
-                int id = result.rows()[0][0].as_int64();
-                _conn.execute(_conn.prepare_statement(
-                    "UPDATE paths SET path=? WHERE id=?"
-                    ).bind(path->getPathSpan(), id), result);
-            } else {
-                _conn.execute(_conn.prepare_statement(
-                    "INSERT INTO paths (path, period, short_term_state_key) VALUES (?,?,?)"
-                    ).bind(path->getPathSpan(), path->period, path->shortTermStateId), result);
-            }            
+            execute(
+                "INSERT INTO paths (path, period, short_term_state_key) VALUES (?,?,?) ON DUPLICATE KEY UPDATE path=VALUES(path)",
+                result, pathBlob, path->period, path->shortTermStateId);
         } else if (path->longTermStateId != -1) {
-            _conn.execute(_conn.prepare_statement(
-                "SELECT id FROM paths WHERE period=? AND long_term_state_key=?"
-            ).bind(path->period, path->longTermStateId), result);
-            if (result.rows().size() > 0) {
-                int id = result.rows()[0][0].as_int64();
-                _conn.execute(_conn.prepare_statement(
-                    "UPDATE paths SET path=? WHERE id=?"
-                    ).bind(path->getPathSpan(), id), result);
-            } else {
-                _conn.execute(_conn.prepare_statement(
-                    "INSERT INTO paths (path, period, long_term_state_key) VALUES (?,?,?)"
-                    ).bind(path->getPathSpan(), path->period, path->longTermStateId), result);
-            }
+            execute(
+                "INSERT INTO paths (path, period, long_term_state_key) VALUES (?,?,?) ON DUPLICATE KEY UPDATE path=VALUES(path)",
+                result, pathBlob, path->period, path->longTermStateId);
         }
         printf("Done\n");
     }
@@ -767,9 +1055,9 @@ void DBConnection::copyPaths(ShortTermStatePtr sts, LongTermStatePtr lts) {
     try {
         fmt::print("Copying paths from sts {} to lts {} ... ", sts->id, lts->id);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO paths (path, period, long_term_state_key) SELECT path, period, ? FROM paths WHERE short_term_state_key=?"
-        ).bind(lts->id, sts->id), result);
+        execute(
+            "INSERT INTO paths (path, period, long_term_state_key) SELECT path, period, ? FROM paths WHERE short_term_state_key=?",
+            result, lts->id, sts->id);
         printf("Done\n");
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -789,9 +1077,9 @@ int DBConnection::getScheduledRoom(int studentId, int period) {
     try {
         fmt::print("Gettting room for student {} in period {} ... ", studentId, period);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "SELECT room_id FROM schedules WHERE student_id=? AND period=?"
-        ).bind(studentId, period), result);
+        execute(
+            "SELECT room_id FROM schedules WHERE student_id=? AND period=?",
+            result, studentId, period);
         printf("Done\n");
         return result.rows()[0][0].as_int64();
     }
@@ -829,9 +1117,9 @@ void DBConnection::getSchedules(std::vector<Schedule>& schedules) {
 void DBConnection::addToSchedule(int studentId, int period, int roomId) {
     try {
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO schedules (student_id, period, room_id) VALUES (?,?,?)"
-        ).bind(studentId, period, roomId), result);
+        execute(
+            "INSERT INTO schedules (student_id, period, room_id) VALUES (?,?,?)",
+            result, studentId, period, roomId);
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -844,9 +1132,9 @@ void DBConnection::setAttendance(int room, int period, int studentId, Attendance
         std::string statusS = status == AttendanceStatus::ABSENT ? "ABSENT" : "PRESENT";
         fmt::print("Setting attendance for student {} in period {} to {} ... ", studentId, period, statusS);
         boost::mysql::results result;
-        _conn.execute(_conn.prepare_statement(
-            "INSERT INTO attendance (room_id, period, student_id, status) VALUES (?,?,?,?)"
-        ).bind(room, period, studentId, statusS), result);
+        execute(
+            "INSERT INTO attendance (room_id, period, student_id, status) VALUES (?,?,?,?)",
+            result, room, period, studentId, statusS);
         printf("Done\n");
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
@@ -864,12 +1152,27 @@ int DBConnection::getPeriod() {
     return -1;
 }
 
+bool DBConnection::getGlobals(int& period, int& epoch) {
+    boost::mysql::results result;
+    if (query("SELECT period, epoch FROM globals", result) && result.rows().size() > 0) {
+        period = result.rows()[0][0].as_int64();
+        epoch = result.rows()[0][1].is_null() ? 0 : result.rows()[0][1].as_int64();
+        return true;
+    }
+    period = -1;
+    epoch = -1;
+    return false;
+}
+
+void DBConnection::bumpStateEpoch() {
+    boost::mysql::results result;
+    query("UPDATE globals SET epoch = epoch + 1", result);
+}
+
 void DBConnection::setPeriod(int period) {
     try {
         boost::mysql::results result;
-        _conn.execute(
-            _conn.prepare_statement("UPDATE globals SET period=?")
-            .bind(period), result);\
+        execute("UPDATE globals SET period=?", result, period);\
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -881,8 +1184,7 @@ int DBConnection::addStudent() {
     try {
         boost::mysql::results result;
         query("INSERT INTO students () VALUES()", result);
-        query("SELECT LAST_INSERT_ID()", result);
-        return result.rows()[0][0].as_uint64();
+        return result.last_insert_id();
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -891,12 +1193,27 @@ int DBConnection::addStudent() {
     return -1;
 }
 
+void DBConnection::addStudents(int count, std::vector<int>& ids) {
+    InsertBatch batch("students", {});
+    for (int i = 0; i < count; i++) {
+        batch.add();
+    }
+    flush(batch, &ids);
+}
+
+InsertBatch DBConnection::studentDataBatch(size_t maxRows) {
+    return InsertBatch("facial_data", { "student_id", "device_id", "facial_features" }, maxRows);
+}
+
+void DBConnection::pushStudentData(InsertBatch& batch, int studentId, int deviceId, boost::span<const UCHAR> facialFeatures) {
+    batch.add(studentId, deviceId, facialFeatures);
+    flushIfDue(batch);
+}
+
 void DBConnection::pushStudentData(UpdatePtr data, int studentId) {
     try {
         boost::mysql::results result;
-        _conn.execute(
-            _conn.prepare_statement("INSERT INTO facial_data (student_id, device_id, facial_features) VALUES(?, ?, ?)")
-            .bind(studentId, data->deviceId, data->getFacialFeatures()), result);
+        execute("INSERT INTO facial_data (student_id, device_id, facial_features) VALUES(?, ?, ?)", result, studentId, data->deviceId, data->getFacialFeatures());
     }
     catch (const boost::mysql::error_with_diagnostics& err) {
         std::cerr << "Error: " << err.what() << '\n'
@@ -906,11 +1223,18 @@ void DBConnection::pushStudentData(UpdatePtr data, int studentId) {
 
 void DBConnection::initGlobals() {
     boost::mysql::results r;
-    query("INSERT INTO globals (period) VALUES(1)", r);
+    // the state epoch is a plain counter from 0. A reset counts on from the kept row, so a
+    // running lambda doesn't mistake the new states for the ones it cached.
+    if (query("UPDATE globals SET period = 1, epoch = COALESCE(epoch, 0) + 1", r) && r.affected_rows() == 0) {
+        query("INSERT INTO globals (period, epoch) VALUES(1, 0)", r);
+    }
 }
 
-TimePoint DBConnection::getTime() {
+bool DBConnection::getTime(TimePoint& time) {
     boost::mysql::results r;
-    query("SELECT CURRENT_TIMESTAMP()", r);
-    return r.rows()[0][0].as_datetime().as_time_point();
+    if (!query("SELECT CURRENT_TIMESTAMP()", r) || r.rows().empty()) {
+        return false;
+    }
+    time = r.rows()[0][0].as_datetime().as_time_point();
+    return true;
 }
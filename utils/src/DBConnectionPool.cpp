@@ -0,0 +1,61 @@
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#include "utils/DBConnectionPool.h"
+
+DBConnectionPool::DBConnectionPool(int size) {
+    size = std::max(1, size);
+    for (int i = 0; i < size; i++) {
+        _connections.push_back(std::unique_ptr<DBConnection>(new DBConnection()));
+        _free.push_back(_connections.back().get());
+    }
+}
+
+bool DBConnectionPool::connect() {
+    fmt::println("Opening {} database connections", _connections.size());
+    int connected = 0;
+    for (auto& conn : _connections) {
+        // ones that fail are retried when they are first leased
+        if (conn->connect()) connected++;
+    }
+    return connected > 0;
+}
+
+DBConnectionPool::Lease DBConnectionPool::lease() {
+    DBConnection* conn;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _available.wait(lock, [this] { return !_free.empty(); });
+        // prefer a connection that is known to work
+        auto it = std::find_if(_free.begin(), _free.end(), [](DBConnection* c) { return c->healthy(); });
+        if (it == _free.end()) it = _free.begin();
+        conn = *it;
+        _free.erase(it);
+    }
+    // checked outside the lock, the connection is ours now
+    if (conn->healthy() && std::chrono::steady_clock::now() - conn->lastUsed() > std::chrono::milliseconds(DB_POOL_IDLE_CHECK_MS)) {
+        conn->ping();
+    }
+    if (!conn->healthy()) {
+        conn->reconnect();
+    }
+    return Lease(this, conn);
+}
+
+void DBConnectionPool::getStatementStats(std::vector<StatementStats>& stats) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _available.wait(lock, [this] { return _free.size() == _connections.size(); });
+    for (auto& conn : _connections) {
+        conn->getStatementStats(stats);
+    }
+}
+
+void DBConnectionPool::release(DBConnection* conn) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free.push_back(conn);
+    }
+    // wakes getStatementStats as well as anyone waiting for a lease
+    _available.notify_all();
+}
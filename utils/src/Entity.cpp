@@ -3,7 +3,7 @@
 
 #include "utils/EntityState.h"
 
-void loadUpdateCov(std::string filename, FFMat& R) {
+void loadUpdateCov(std::string filename, FFCov& R) {
     fmt::print("Loading update covariance matrix from {} ... ", filename);
     try {
         std::ifstream file(filename);
@@ -20,7 +20,11 @@ void loadUpdateCov(std::string filename, FFMat& R) {
                 int col = 0;
                 while (std::getline(s, num, ',')) {
                     if (row == col)
+#ifdef FACE_COV_DENSE
                        R(row, col) = stof(num);
+#else
+                       R(row) = stof(num);
+#endif
                     col++;
                 }
                 if (col != FACE_VEC_SIZE) {
@@ -48,56 +52,49 @@ double l2Distance(const FFVec& first, const FFVec& second) {
     return distance;
 }
 
+void EntityState::setFacialFeaturesCov(boost::span<const UCHAR> facialFeaturesCov_) {
+    const size_t denseBytes = FACE_VEC_SIZE * FACE_VEC_SIZE * sizeof(float);
+    const size_t diagonalBytes = FACE_VEC_SIZE * sizeof(float);
+    if (facialFeaturesCov_.size_bytes() == sizeof(FFCov)) {
+        memcpy(facialFeaturesCov.data(), facialFeaturesCov_.data(), facialFeaturesCov_.size_bytes());
+        return;
+    }
+    const float* cov = reinterpret_cast<const float*>(facialFeaturesCov_.data());
+#ifdef FACE_COV_DENSE
+    if (facialFeaturesCov_.size_bytes() == diagonalBytes) {
+        facialFeaturesCov = FFVec(Eigen::Map<const FFVec>(cov)).asDiagonal();
+        return;
+    }
+#else
+    if (facialFeaturesCov_.size_bytes() == denseBytes) {
+        facialFeaturesCov = Eigen::Map<const FFMat>(cov).diagonal();
+        return;
+    }
+#endif
+    if (facialFeaturesCov_.size_bytes() != 0) {
+        fmt::println("EntityState::setFacialFeaturesCov - Error: unexpected covariance size {}", facialFeaturesCov_.size_bytes());
+    }
+}
+
 void EntityState::kalmanUpdate(std::shared_ptr<EntityState> update) {
 
    // z measurement vector is update->facialFeatures
    // H is identity
 
-   static FFMat I = FFMat::Identity();
-   static FFMat* K = new FFMat();
+#ifdef FACE_COV_DENSE
+   static const FFMat I = FFMat::Identity();
+   // kept off the stack, one per thread so states can update in parallel
+   static thread_local std::unique_ptr<FFMat> K(new FFMat());
    *K = facialFeaturesCov * (facialFeaturesCov + update->facialFeaturesCov).inverse();
 
    facialFeatures += *K * (update->facialFeatures - facialFeatures);
    facialFeaturesCov = (I - *K) * facialFeaturesCov;
+#else
+   // with diagonal covariances every feature is an independent scalar filter
+   FFVec K = (facialFeaturesCov.array() / (facialFeaturesCov + update->facialFeaturesCov).array()).matrix();
 
-}
-
-void Entity::step(float dt) {
-
-    const iGrid& pathMap = *_pathMap;
-
-    glm::ivec2 ipos = { round(_pos.x), round(_pos.y) };
-
-    int current = pathMap[ipos.x][ipos.y];
-    if (current == 0) return;
-    if (current == -2) {
-        current = 1e3;
-    }
-
-    int li = 0, lj = 0;
-    float step = 0.0;
-    for (int i = -1; i < 2; i++) {
-        for (int j = -1; j < 2; j++) {
-            if (
-                !(i == 0 && j == 0) &&
-                ipos.x + i >= 0 && ipos.x + i < pathMap.size() &&
-                ipos.y + j >= 0 && ipos.y + j < pathMap[ipos.x].size() &&
-                pathMap[ipos.x + i][ipos.y + j] != -2 &&
-                current - pathMap[ipos.x + i][ipos.y + j] > step) {
-                li = i;
-                lj = j;
-                int a = 0;
-                step = current - pathMap[ipos.x + i][ipos.y + j];
-                if (i * j == 0) {
-                    step += 0.1;
-                }
-            }
-        }
-    }
-    if (li == 0 && lj == 0) return;
-
-    glm::vec2 dir = glm::normalize(glm::vec2(glm::ivec2(ipos.x + li, ipos.y + lj) - ipos));
-    _pos += dir * dt;
-    _heading = atan2f(dir.y, dir.x);
+   facialFeatures += K.cwiseProduct(update->facialFeatures - facialFeatures);
+   facialFeaturesCov = (1.0f - K.array()).matrix().cwiseProduct(facialFeaturesCov);
+#endif
 
 }
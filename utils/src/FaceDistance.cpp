@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "utils/FaceDistance.h"
+#include "utils/SimdKernels.h"
+
+// Candidates per block, sized so the block of running distances stays in L1
+#define DISTANCE_BLOCK 512
+// Row padding so every row starts on a full vector of floats
+#define FACE_MATRIX_ALIGN 16
+// Faces per side of a pairwise distance tile, a tile's column panel stays in L1
+#define PAIRWISE_TILE 64
+
+int FaceMatrix::add(const FFVec& features) {
+    if (_size == _stride) {
+        reserve(_stride == 0 ? 64 : _stride * 2);
+    }
+    set(_size, features);
+    return _size++;
+}
+
+void FaceMatrix::set(int index, const FFVec& features) {
+    for (int k = 0; k < FACE_VEC_SIZE; k++) {
+        _data[(size_t)k * _stride + index] = features[k];
+    }
+}
+
+FFVec FaceMatrix::get(int index) const {
+    FFVec features;
+    for (int k = 0; k < FACE_VEC_SIZE; k++) {
+        features[k] = _data[(size_t)k * _stride + index];
+    }
+    return features;
+}
+
+void FaceMatrix::remove(int index) {
+    // move the last column into the hole, callers track the swap
+    _size--;
+    if (index != _size) {
+        for (int k = 0; k < FACE_VEC_SIZE; k++) {
+            _data[(size_t)k * _stride + index] = _data[(size_t)k * _stride + _size];
+        }
+    }
+}
+
+void FaceMatrix::clear() {
+    _size = 0;
+}
+
+void FaceMatrix::reserve(int capacity) {
+    int stride = (capacity + FACE_MATRIX_ALIGN - 1) / FACE_MATRIX_ALIGN * FACE_MATRIX_ALIGN;
+    if (stride <= _stride) return;
+    std::vector<float> data((size_t)FACE_VEC_SIZE * stride, 0.0f);
+    for (int k = 0; k < FACE_VEC_SIZE && _size > 0; k++) {
+        memcpy(data.data() + (size_t)k * stride, _data.data() + (size_t)k * _stride, _size * sizeof(float));
+    }
+    _data.swap(data);
+    _stride = stride;
+}
+
+const char* faceDistanceKernel() {
+    return simdLevelName(simdKernels().level);
+}
+
+void batchL2Distance(const FFVec& query, const FaceMatrix& candidates, std::vector<float>& distances) {
+    int n = candidates.size();
+    distances.assign(n, 0.0f);
+    auto accumulate = simdKernels().accumulateSquaredDiff;
+    for (int start = 0; start < n; start += DISTANCE_BLOCK) {
+        int count = std::min(DISTANCE_BLOCK, n - start);
+        float* out = distances.data() + start;
+        for (int k = 0; k < FACE_VEC_SIZE; k++) {
+            accumulate(candidates.feature(k) + start, query[k], out, count);
+        }
+    }
+}
+
+void batchL2Matches(const FFVec& query, const FaceMatrix& candidates, float thresh, std::vector<FaceMatch>& matches, int k) {
+    std::vector<float> distances;
+    batchL2Distance(query, candidates, distances);
+
+    matches.clear();
+    for (int i = 0; i < distances.size(); i++) {
+        if (distances[i] < thresh) {
+            matches.push_back(FaceMatch{ i, distances[i] });
+        }
+    }
+
+    auto closer = [](const FaceMatch& a, const FaceMatch& b) { return a.distance < b.distance; };
+    if (k > 0 && matches.size() > k) {
+        std::partial_sort(matches.begin(), matches.begin() + k, matches.end(), closer);
+        matches.resize(k);
+    } else {
+        std::sort(matches.begin(), matches.end(), closer);
+    }
+}
+
+void pairwiseL2Distances(const float* faces, int n, ThreadPool& pool, const std::function<void(const DistanceTile&)>& fn) {
+    if (n <= 0) return;
+    int blocks = (n + PAIRWISE_TILE - 1) / PAIRWISE_TILE;
+
+    // k major copy, as FaceMatrix stores them, so a tile's columns are contiguous for each feature
+    std::vector<float> columns((size_t)FACE_VEC_SIZE * n);
+    std::vector<float> norms(n);
+    pool.parallelFor(blocks, [&](int block) {
+        for (int i = block * PAIRWISE_TILE; i < std::min(n, (block + 1) * PAIRWISE_TILE); i++) {
+            const float* face = faces + (size_t)i * FACE_VEC_SIZE;
+            float norm = 0.0f;
+            for (int k = 0; k < FACE_VEC_SIZE; k++) {
+                columns[(size_t)k * n + i] = face[k];
+                norm += face[k] * face[k];
+            }
+            norms[i] = norm;
+        }
+    });
+
+    // row block b goes with row block blocks - 1 - b, so every task covers about the same number of tiles
+    pool.parallelFor((blocks + 1) / 2, [&](int task) {
+        std::vector<float> tile(PAIRWISE_TILE * PAIRWISE_TILE);
+        auto dotTile = simdKernels().dotTile;
+        int rowBlocks[2] = { task, blocks - 1 - task };
+        for (int b = 0; b < (rowBlocks[0] == rowBlocks[1] ? 1 : 2); b++) {
+            int rowBegin = rowBlocks[b] * PAIRWISE_TILE;
+            int rows = std::min(PAIRWISE_TILE, n - rowBegin);
+            for (int colBegin = rowBegin; colBegin < n; colBegin += PAIRWISE_TILE) {
+                int cols = std::min(PAIRWISE_TILE, n - colBegin);
+                for (int r = 0; r < rows; r++) {
+                    float* out = tile.data() + r * cols;
+                    dotTile(faces + (size_t)(rowBegin + r) * FACE_VEC_SIZE, columns.data() + colBegin, n, cols, FACE_VEC_SIZE, out);
+                    float rowNorm = norms[rowBegin + r];
+                    for (int c = 0; c < cols; c++) {
+                        // cancellation can leave near identical faces slightly negative
+                        out[c] = std::max(0.0f, rowNorm + norms[colBegin + c] - 2.0f * out[c]);
+                    }
+                }
+                fn(DistanceTile{ rowBegin, rows, colBegin, cols, tile.data() });
+            }
+        }
+    });
+}
+
+DistanceHistogram::DistanceHistogram(float max, int bins) : _bins(std::max(1, bins)), _scale(_bins / max), _counts(_bins, 0) {}
+
+void DistanceHistogram::merge(const DistanceHistogram& other) {
+    for (int bin = 0; bin < std::min(_bins, other._bins); bin++) {
+        _counts[bin] += other._counts[bin];
+    }
+}
+
+long long DistanceHistogram::count() const {
+    long long total = 0;
+    for (long long binCount : _counts) {
+        total += binCount;
+    }
+    return total;
+}
+
+float DistanceHistogram::quantile(double q) const {
+    long long target = (long long)std::ceil(q * count());
+    long long seen = 0;
+    for (int bin = 0; bin < _bins; bin++) {
+        seen += _counts[bin];
+        if (seen >= target && seen > 0) {
+            return (bin + 1) / _scale;
+        }
+    }
+    return _bins / _scale;
+}
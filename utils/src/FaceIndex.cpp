@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <queue>
+#include <cmath>
+
+#include "utils/FaceIndex.h"
+
+std::unique_ptr<FaceIndex> FaceIndex::create(FaceIndexType type) {
+    switch (type) {
+    case HNSW_INDEX:
+        return std::unique_ptr<FaceIndex>(new HnswFaceIndex());
+    case BRUTE_FORCE_INDEX:
+    default:
+        return std::unique_ptr<FaceIndex>(new BruteForceFaceIndex());
+    }
+}
+
+void BruteForceFaceIndex::insert(int id, const FFVec& features) {
+    if (contains(id)) {
+        update(id, features);
+        return;
+    }
+    _columns[id] = _means.add(features);
+    _ids.push_back(id);
+}
+
+void BruteForceFaceIndex::update(int id, const FFVec& features) {
+    auto col = _columns.find(id);
+    if (col == _columns.end()) {
+        insert(id, features);
+        return;
+    }
+    _means.set(col->second, features);
+}
+
+void BruteForceFaceIndex::remove(int id) {
+    auto col = _columns.find(id);
+    if (col == _columns.end()) return;
+    int index = col->second;
+    _columns.erase(col);
+    // the matrix fills the hole with its last column, follow it
+    _means.remove(index);
+    if (index != _ids.size() - 1) {
+        _ids[index] = _ids.back();
+        _columns[_ids[index]] = index;
+    }
+    _ids.pop_back();
+}
+
+void BruteForceFaceIndex::clear() {
+    _means.clear();
+    _ids.clear();
+    _columns.clear();
+}
+
+void BruteForceFaceIndex::search(const FFVec& query, int k, float maxDistance, std::vector<FaceNeighbor>& neighbors) const {
+    std::vector<FaceMatch> matches;
+    batchL2Matches(query, _means, maxDistance, matches, k);
+    neighbors.clear();
+    for (const FaceMatch& match : matches) {
+        neighbors.push_back(FaceNeighbor{ _ids[match.index], match.distance });
+    }
+}
+
+HnswFaceIndex::HnswFaceIndex(int m, int efConstruction, int efSearch) :
+    _m(m),
+    _mMax0(m * 2),
+    _efConstruction(efConstruction),
+    _efSearch(efSearch),
+    _levelMult(1.0 / log((double)m)),
+    _gen(5678975)
+{}
+
+float HnswFaceIndex::distance(const FFVec& a, int node) const {
+    return (a - _nodes[node]->features).squaredNorm();
+}
+
+float HnswFaceIndex::distance(int a, int b) const {
+    return (_nodes[a]->features - _nodes[b]->features).squaredNorm();
+}
+
+int HnswFaceIndex::greedyClosest(const FFVec& query, int entry, int fromLevel, int toLevel) const {
+    int closest = entry;
+    float closestDistance = distance(query, entry);
+    for (int level = fromLevel; level > toLevel; level--) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int next : _nodes[closest]->links[level]) {
+                float d = distance(query, next);
+                if (d < closestDistance) {
+                    closestDistance = d;
+                    closest = next;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return closest;
+}
+
+void HnswFaceIndex::searchLayer(const FFVec& query, int entry, int ef, int level, std::vector<Candidate>& found) const {
+    std::vector<char> visited(_nodes.size(), 0);
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    std::priority_queue<Candidate> nearest;
+
+    float entryDistance = distance(query, entry);
+    candidates.push({ entryDistance, entry });
+    nearest.push({ entryDistance, entry });
+    visited[entry] = 1;
+
+    while (!candidates.empty()) {
+        Candidate current = candidates.top();
+        if (current.first > nearest.top().first && nearest.size() >= ef) break;
+        candidates.pop();
+        for (int next : _nodes[current.second]->links[level]) {
+            if (visited[next]) continue;
+            visited[next] = 1;
+            float d = distance(query, next);
+            if (nearest.size() < ef || d < nearest.top().first) {
+                candidates.push({ d, next });
+                nearest.push({ d, next });
+                if (nearest.size() > ef) nearest.pop();
+            }
+        }
+    }
+
+    found.resize(nearest.size());
+    for (int i = found.size() - 1; i >= 0; i--) {
+        found[i] = nearest.top();
+        nearest.pop();
+    }
+}
+
+void HnswFaceIndex::selectNeighbors(std::vector<Candidate>& candidates, int m) const {
+    // keep candidates closer to the base than to any neighbour already kept,
+    // then top up with the closest of the rest so sparse regions stay connected
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<Candidate> selected;
+    std::vector<Candidate> pruned;
+    for (const Candidate& candidate : candidates) {
+        if (selected.size() >= m) break;
+        bool keep = true;
+        for (const Candidate& other : selected) {
+            if (distance(candidate.second, other.second) < candidate.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            selected.push_back(candidate);
+        } else {
+            pruned.push_back(candidate);
+        }
+    }
+    for (int i = 0; i < pruned.size() && selected.size() < m; i++) {
+        selected.push_back(pruned[i]);
+    }
+    candidates.swap(selected);
+}
+
+void HnswFaceIndex::connect(int node, int level, std::vector<Candidate>& candidates) {
+    selectNeighbors(candidates, _m);
+    std::vector<int>& links = _nodes[node]->links[level];
+    links.clear();
+    for (const Candidate& candidate : candidates) {
+        links.push_back(candidate.second);
+    }
+
+    int mMax = level == 0 ? _mMax0 : _m;
+    for (const Candidate& candidate : candidates) {
+        std::vector<int>& backLinks = _nodes[candidate.second]->links[level];
+        if (std::find(backLinks.begin(), backLinks.end(), node) != backLinks.end()) continue;
+        backLinks.push_back(node);
+        if (backLinks.size() > mMax) {
+            std::vector<Candidate> shrink;
+            for (int link : backLinks) {
+                shrink.push_back({ distance(candidate.second, link), link });
+            }
+            selectNeighbors(shrink, mMax);
+            backLinks.clear();
+            for (const Candidate& kept : shrink) {
+                backLinks.push_back(kept.second);
+            }
+        }
+    }
+}
+
+void HnswFaceIndex::insert(int id, const FFVec& features) {
+    if (contains(id)) {
+        update(id, features);
+        return;
+    }
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    int level = (int)floor(-log(1.0 - uniform(_gen)) * _levelMult);
+
+    int node = _nodes.size();
+    _nodes.push_back(std::unique_ptr<Node>(new Node()));
+    _nodes[node]->id = id;
+    _nodes[node]->removed = false;
+    _nodes[node]->features = features;
+    _nodes[node]->links.resize(level + 1);
+    _nodeIds[id] = node;
+
+    if (_entry == -1) {
+        _entry = node;
+        _maxLevel = level;
+        return;
+    }
+
+    int entry = greedyClosest(features, _entry, _maxLevel, level);
+    std::vector<Candidate> found;
+    for (int l = std::min(level, _maxLevel); l >= 0; l--) {
+        searchLayer(features, entry, _efConstruction, l, found);
+        entry = found[0].second;
+        connect(node, l, found);
+    }
+
+    if (level > _maxLevel) {
+        _entry = node;
+        _maxLevel = level;
+    }
+}
+
+void HnswFaceIndex::update(int id, const FFVec& features) {
+    auto nodeId = _nodeIds.find(id);
+    if (nodeId == _nodeIds.end()) {
+        insert(id, features);
+        return;
+    }
+    int node = nodeId->second;
+    _nodes[node]->features = features;
+    if (_nodeIds.size() + _removed == 1) return;
+
+    // relink the moved node on every level it lives on, old links into it stay
+    // valid edges and get pruned as neighbours fill up
+    int level = _nodes[node]->links.size() - 1;
+    int entry = greedyClosest(features, _entry, _maxLevel, level);
+    std::vector<Candidate> found;
+    for (int l = level; l >= 0; l--) {
+        searchLayer(features, entry, _efConstruction + 1, l, found);
+        found.erase(std::remove_if(found.begin(), found.end(), [node](const Candidate& c) { return c.second == node; }), found.end());
+        if (found.empty()) continue;
+        entry = found[0].second;
+        connect(node, l, found);
+    }
+}
+
+void HnswFaceIndex::remove(int id) {
+    auto nodeId = _nodeIds.find(id);
+    if (nodeId == _nodeIds.end()) return;
+    _nodes[nodeId->second]->removed = true;
+    _nodeIds.erase(nodeId);
+    _removed++;
+    if (_removed > 16 && _removed > _nodeIds.size()) {
+        rebuild();
+    }
+}
+
+void HnswFaceIndex::clear() {
+    _nodes.clear();
+    _nodeIds.clear();
+    _entry = -1;
+    _maxLevel = -1;
+    _removed = 0;
+}
+
+void HnswFaceIndex::rebuild() {
+    std::vector<std::unique_ptr<Node>> nodes;
+    nodes.swap(_nodes);
+    clear();
+    for (std::unique_ptr<Node>& node : nodes) {
+        if (!node->removed) {
+            insert(node->id, node->features);
+        }
+    }
+}
+
+void HnswFaceIndex::search(const FFVec& query, int k, float maxDistance, std::vector<FaceNeighbor>& neighbors) const {
+    neighbors.clear();
+    if (_entry == -1) return;
+
+    int entry = greedyClosest(query, _entry, _maxLevel, 0);
+    std::vector<Candidate> found;
+    searchLayer(query, entry, std::max(_efSearch, k), 0, found);
+    for (const Candidate& candidate : found) {
+        if (candidate.first >= maxDistance) break;
+        if (_nodes[candidate.second]->removed) continue;
+        neighbors.push_back(FaceNeighbor{ _nodes[candidate.second]->id, candidate.first });
+        if (k > 0 && neighbors.size() == k) break;
+    }
+}
@@ -0,0 +1,148 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include <fmt/core.h>
+
+#include "utils/Ingest.h"
+
+// How long a producer waits before trying to reach the lambda again
+#define INGEST_RETRY_MS 5000
+
+UpdateQueue::UpdateQueue(size_t capacity) : _ring(capacity) {}
+
+bool UpdateQueue::push(UpdatePtr update) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_count == _ring.size()) {
+            _dropped++;
+            return false;
+        }
+        _ring[(_head + _count) % _ring.size()] = update;
+        _count++;
+    }
+    _ready.notify_one();
+    return true;
+}
+
+size_t UpdateQueue::pop(std::vector<UpdatePtr>& updates, size_t max, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_ready.wait_for(lock, timeout, [this] { return _count > 0; })) {
+        return 0;
+    }
+    size_t taken = 0;
+    while (_count > 0 && taken < max) {
+        updates.push_back(std::move(_ring[_head]));
+        _head = (_head + 1) % _ring.size();
+        _count--;
+        taken++;
+    }
+    return taken;
+}
+
+size_t UpdateQueue::size() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _count;
+}
+
+size_t UpdateQueue::takeDropped() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t dropped = _dropped;
+    _dropped = 0;
+    return dropped;
+}
+
+IngestServer::IngestServer(UpdateQueue& queue, unsigned short port) : _queue(queue), _port(port), _acceptor(_ctx) {}
+
+IngestServer::~IngestServer() {
+    stop();
+}
+
+bool IngestServer::start() {
+    try {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), _port);
+        _acceptor.open(endpoint.protocol());
+        _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        _acceptor.bind(endpoint);
+        _acceptor.listen();
+    }
+    catch (const std::exception& err) {
+        std::cerr << "IngestServer: failed to listen on port " << _port << ": " << err.what() << std::endl;
+        return false;
+    }
+    fmt::println("Listening for detections on 127.0.0.1:{}", _port);
+    accept();
+    _thread = std::thread([this] { _ctx.run(); });
+    return true;
+}
+
+void IngestServer::stop() {
+    _ctx.stop();
+    if (_thread.joinable()) _thread.join();
+}
+
+void IngestServer::accept() {
+    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(_ctx);
+    _acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+        if (ec) return;
+        boost::system::error_code optionEc;
+        socket->set_option(boost::asio::ip::tcp::no_delay(true), optionEc);
+        read(socket, std::make_shared<IngestFrame>());
+        accept();
+    });
+}
+
+void IngestServer::read(std::shared_ptr<boost::asio::ip::tcp::socket> socket, std::shared_ptr<IngestFrame> frame) {
+    boost::asio::async_read(*socket, boost::asio::buffer(frame.get(), sizeof(IngestFrame)),
+        [this, socket, frame](const boost::system::error_code& ec, size_t) {
+            if (ec) return;
+            UpdatePtr update(new Update(frame->updateId, frame->deviceId,
+                boost::span<const UCHAR>(reinterpret_cast<const UCHAR*>(frame->facialFeatures), sizeof(frame->facialFeatures))));
+            if (!_queue.push(update)) {
+                fmt::println("IngestServer: queue full, leaving update {} to the poll", frame->updateId);
+            }
+            read(socket, frame);
+        });
+}
+
+IngestClient::IngestClient(unsigned short port) : _port(port), _socket(_ctx) {}
+
+IngestClient::~IngestClient() {
+    boost::system::error_code ec;
+    _socket.close(ec);
+}
+
+bool IngestClient::connect() {
+    if (_connected) return true;
+    if (std::chrono::steady_clock::now() < _retryAt) return false;
+    boost::system::error_code ec;
+    _socket.close(ec);
+    _socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), _port), ec);
+    if (ec) {
+        _retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(INGEST_RETRY_MS);
+        return false;
+    }
+    _socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    _connected = true;
+    return true;
+}
+
+bool IngestClient::send(int updateId, int deviceId, boost::span<const UCHAR> facialFeatures) {
+    if (!connect()) return false;
+    IngestFrame frame;
+    frame.updateId = updateId;
+    frame.deviceId = deviceId;
+    memcpy(frame.facialFeatures, facialFeatures.data(), std::min(facialFeatures.size_bytes(), sizeof(frame.facialFeatures)));
+    boost::system::error_code ec;
+    boost::asio::write(_socket, boost::asio::buffer(&frame, sizeof(frame)), ec);
+    if (ec) {
+        _connected = false;
+        _retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(INGEST_RETRY_MS);
+        return false;
+    }
+    return true;
+}
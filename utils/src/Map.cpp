@@ -1,8 +1,31 @@
 #include<algorithm>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 
 #include <fmt/core.h>
+#include <boost/property_tree/xml_parser.hpp>
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/gtx/matrix_transform_2d.hpp>
 
 #include "utils/Map.h"
+#include "utils/ThreadPool.h"
+
+#define PATH_MAP_STORE_MAGIC "FAPMAPS"
+
+int Map::_threads = 0;
+
+PathMap::PathMap(int width, int height, std::vector<int16_t> cells) : _width(width), _height(height) {
+    auto owned = std::make_shared<std::vector<int16_t>>(std::move(cells));
+    _cells = owned->data();
+    _owner = owned;
+}
+
+PathMap::PathMap(int width, int height, const int16_t* cells, std::shared_ptr<const void> owner) :
+    _width(width), _height(height), _cells(cells), _owner(owner) {}
 
 DeviceView::DeviceView(int id_, glm::vec2 pos_, float angle_) {
 
@@ -25,27 +48,33 @@ Map::Map(std::string filename) {
 
     fmt::print("Loading map from {} ... ", filename);
 
-	ci::XmlTree doc(ci::loadFile(filename));
-	ci::XmlTree map = doc.getChild("map");
-	size.x = map.getAttributeValue<float>("width");
-	size.y = map.getAttributeValue<float>("height");
-	loadBounds(map, "inBound", inBounds);
-	loadBounds(map, "outBound", outBounds);
-	for (ci::XmlTree::Iter child = map.begin("device"); child != map.end(); ++child) {
-		int id = child->getAttributeValue<int>("id");
-		float x = child->getAttributeValue<float>("x");
-		float y = child->getAttributeValue<float>("y");
-		float angle = child->getAttributeValue<float>("direction");
-		devs.push_back(DeviceView( id, {x, y}, angle));
+    _mapHash = hashFile(filename);
+
+	boost::property_tree::ptree doc;
+	boost::property_tree::read_xml(filename, doc);
+	const boost::property_tree::ptree& map = doc.get_child("map");
+	size.x = map.get<float>("<xmlattr>.width");
+	size.y = map.get<float>("<xmlattr>.height");
+	for (const auto& [name, child] : map) {
+		if (name == "inBound") {
+			loadBound(child, inBounds);
+		} else if (name == "outBound") {
+			loadBound(child, outBounds);
+		} else if (name == "device") {
+			int id = child.get<int>("<xmlattr>.id");
+			float x = child.get<float>("<xmlattr>.x");
+			float y = child.get<float>("<xmlattr>.y");
+			float angle = child.get<float>("<xmlattr>.direction");
+			devs.push_back(DeviceView( id, {x, y}, angle));
+		} else if (name == "door") {
+			int id = child.get<int>("<xmlattr>.id");
+			float x = child.get<float>("<xmlattr>.x");
+			float y = child.get<float>("<xmlattr>.y");
+			float angle = child.get<float>("<xmlattr>.angle");
+			doors.push_back(Door{ id, {x, y}, angle });
+		}
 	}
     std::sort(devs.begin(), devs.end(), [](const DeviceView& a, const DeviceView& b) {return a.id < b.id;});
-	for (ci::XmlTree::Iter child = map.begin("door"); child != map.end(); ++child) {
-		int id = child->getAttributeValue<int>("id");
-		float x = child->getAttributeValue<float>("x");
-		float y = child->getAttributeValue<float>("y");
-		float angle = child->getAttributeValue<float>("angle");
-		doors.push_back(Door{ id, {x, y}, angle });
-	}
 
     for (int i = 0; i < devs.size(); i++) {
         for (int j = i + 1; j < devs.size(); j++) {
@@ -56,11 +85,13 @@ Map::Map(std::string filename) {
         }
     }
 
+    rasterize();
+
     printf("Done\n");
 }
 
-ci::Shape2d Map::makeRect(glm::vec2 topLeft, float width, float height) {
-	ci::Shape2d shape;
+Shape2d Map::makeRect(glm::vec2 topLeft, float width, float height) {
+	Shape2d shape;
 	shape.moveTo(topLeft);
 	shape.lineTo(glm::vec2(topLeft.x + width, topLeft.y));
 	shape.lineTo(glm::vec2(topLeft.x + width, topLeft.y + height));
@@ -69,47 +100,109 @@ ci::Shape2d Map::makeRect(glm::vec2 topLeft, float width, float height) {
 	return shape;
 }
 
-void Map::loadBounds(ci::XmlTree map, std::string name, std::vector<ci::Shape2d>& bounds) {
-	for (ci::XmlTree::Iter child = map.begin(name); child != map.end(); ++child) {
-		float x = child->getAttributeValue<float>("x");
-		float y = child->getAttributeValue<float>("y");
-		float width = child->getAttributeValue<float>("width");
-		float height = child->getAttributeValue<float>("height");
-		bounds.push_back(makeRect({ x, y }, width, height));
-	}
+void Map::loadBound(const boost::property_tree::ptree& bound, std::vector<Shape2d>& bounds) {
+	float x = bound.get<float>("<xmlattr>.x");
+	float y = bound.get<float>("<xmlattr>.y");
+	float width = bound.get<float>("<xmlattr>.width");
+	float height = bound.get<float>("<xmlattr>.height");
+	bounds.push_back(makeRect({ x, y }, width, height));
 }
 
-void Map::generatePathMaps(std::vector<std::set<int>>& matches) {
-    printf("Generating path maps ... ");
-    bool getMatches = matches.size() == 0;
-	for (Door door : doors) {
-        _pathMaps.push_back(iGrid());
-        if (getMatches) {
-            std::set<int> devs;
-            createPathMap(_pathMaps.back(), door.pos, devs);
-            matches.push_back(devs);
+template<class Fn>
+void Map::forEachCell(const Shape2d& shape, Fn fn) const {
+    // no point outside the bounding box can be inside the shape
+    Rect2d box = shape.calcBoundingBox();
+    int minX = std::max(0, (int)std::ceil(std::min(box.x1, box.x2)));
+    int maxX = std::min(_gridWidth - 1, (int)std::floor(std::max(box.x1, box.x2)));
+    int minY = std::max(0, (int)std::ceil(std::min(box.y1, box.y2)));
+    int maxY = std::min(_gridHeight - 1, (int)std::floor(std::max(box.y1, box.y2)));
+    for (int x = minX; x <= maxX; x++) {
+        for (int y = minY; y <= maxY; y++) {
+            if (shape.contains(glm::vec2(x, y))) {
+                fn(x * _gridHeight + y);
+            }
+        }
+    }
+}
+
+void Map::rasterize() {
+    _gridWidth = size.x + 1;
+    _gridHeight = size.y + 1;
+    _cells.assign(_gridWidth * _gridHeight, 0);
+
+    for (const Shape2d& inBound : inBounds) {
+        forEachCell(inBound, [&](int cell) { _cells[cell] |= CELL_OPEN; });
+    }
+
+    std::map<int, std::vector<int>> covering;
+    for (int i = 0; i < devs.size(); i++) {
+        forEachCell(devs[i].view, [&](int cell) { covering[cell].push_back(i); });
+    }
+    // cells covered by the same devices share a coverage entry
+    std::map<std::vector<int>, int> coverageIds;
+    _coverage.assign(1, std::vector<int>());
+    for (auto& [cell, coveringDevs] : covering) {
+        auto found = coverageIds.find(coveringDevs);
+        int coverage;
+        if (found != coverageIds.end()) {
+            coverage = found->second;
         } else {
-            createPathMap(_pathMaps.back(), door.pos);
+            coverage = _coverage.size();
+            if (coverage > CELL_COVERAGE) {
+                printf("Map::rasterize - Error: Too many distinct device coverages\n");
+                continue;
+            }
+            coverageIds.emplace(coveringDevs, coverage);
+            _coverage.push_back(coveringDevs);
         }
-	}
+        _cells[cell] |= coverage;
+    }
+
+    for (const Shape2d& outBound : outBounds) {
+        forEachCell(outBound, [&](int cell) { _cells[cell] = 0; });
+    }
+}
+
+void Map::generatePathMaps() {
+    generateDoorPathMaps(nullptr);
+}
+
+void Map::generatePathMaps(std::vector<std::set<int>>& matches) {
+    generateDoorPathMaps(&matches);
+}
+
+void Map::generateDoorPathMaps(std::vector<std::set<int>>* matches) {
+    printf("Generating path maps ... ");
+    // each fill only reads the map and writes its own slot
+    size_t first = _pathMaps.size();
+    _pathMaps.resize(first + doors.size());
+    if (matches != nullptr) {
+        matches->assign(doors.size(), std::set<int>());
+    }
+    ThreadPool pool(poolSize(doors.size()));
+    pool.parallelFor(doors.size(), [&](int i) {
+        std::vector<int16_t> pathMap;
+        fillPathMap(pathMap, doors[i].pos, matches != nullptr ? &(*matches)[i] : nullptr, -1);
+        _pathMaps[first + i] = PathMap(_gridWidth, _gridHeight, std::move(pathMap));
+    });
     printf("Done\n");
 }
 
 void Map::getDeviceConnections(std::vector<std::set<int>>& conns, Eigen::MatrixXd& distances) {
     distances = Eigen::MatrixXd::Zero(devs.size(), devs.size());
-	for (int i = 0; i < devs.size(); i++) {
-        DeviceView dev = devs[i];
-        std::set<int> connectedDevs;
-        iGrid pathMap = iGrid();
-        createPathMap(pathMap, dev.pos, connectedDevs, dev.id);
-        conns.push_back(connectedDevs);
+    conns.assign(devs.size(), std::set<int>());
+    ThreadPool pool(poolSize(devs.size()));
+    pool.parallelFor(devs.size(), [&](int i) {
+        const DeviceView& dev = devs[i];
+        std::vector<int16_t> pathMap;
+        createPathMap(pathMap, dev.pos, conns[i], dev.id);
         createPathMap(pathMap, dev.pos);
         // for (auto j = connectedDevs.begin(); j != connectedDevs.end(); j++) {
         for (int j = 0; j < devs.size(); j++) {
             glm::ivec2 ipos = { round(devs[j].pos.x), round(devs[j].pos.y) };
-            distances(i, j) = pathMap[ipos.x][ipos.y];
+            distances(i, j) = pathMap[ipos.x * _gridHeight + ipos.y];
         }
-	}
+    });
 	for (int i = 0; i < devs.size(); i++) {
         if (devs[i].pair != -1) {
             conns[i].merge(conns[devs[i].pair]);
@@ -118,81 +211,192 @@ void Map::getDeviceConnections(std::vector<std::set<int>>& conns, Eigen::MatrixX
     }
 }
 
-const iGrid* Map::getPathMap(int room) const { return &_pathMaps[room]; }
-iGrid Map::getDevicePathMap(int dev) const {
-    iGrid map = iGrid();
-    createPathMap(map, devs[dev].pos);
-    return map;
+int Map::poolSize(int fills) {
+    int threads = _threads > 0 ? _threads : std::thread::hardware_concurrency();
+    return std::max(1, std::min(threads, fills));
+}
+
+void Map::generateDoorMatches() {
+    printf("Matching doors and devices ... ");
+    _doorMatches.assign(doors.size(), std::set<int>());
+    ThreadPool pool(poolSize(doors.size()));
+    pool.parallelFor(doors.size(), [&](int i) {
+        // the bounded flood is only kept for the devices it ran into
+        std::vector<int16_t> pathMap;
+        fillPathMap(pathMap, doors[i].pos, &_doorMatches[i], -1);
+    });
+    printf("Done\n");
 }
 
-void Map::createPathMap(iGrid& pathMap, glm::ivec2 end, std::set<int>& boundingDevs, int excludeDev) const {
+void Map::loadPathMaps(const std::string& storePath) {
+    std::string path = versionedPath(storePath, PATH_MAP_STORE_VERSION, _mapHash);
+    if (mapStore(path)) return;
 
-    bool bounding = boundingDevs.size() == 0;
+    _pathMaps.clear();
+    generatePathMaps();
+    generateDoorMatches();
+    printf("Writing path map store\n");
+    if (writeStore(path)) {
+        removeOtherVersions(storePath, path);
+    }
+}
 
-    std::vector<int> col(size.y + 1, -2);
-    pathMap = iGrid(size.x + 1, col);
+bool Map::mapStore(const std::string& storePath) {
+    std::shared_ptr<MappedFile> file(new MappedFile(storePath));
+    if (!file->valid() || file->size() < sizeof(PathMapStoreHeader)) {
+        return false;
+    }
+    PathMapStoreHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, PATH_MAP_STORE_MAGIC, sizeof(header.magic)) != 0 || header.version != PATH_MAP_STORE_VERSION) {
+        printf("Path map store is from another version, rebuilding\n");
+        return false;
+    }
+    if (header.mapHash != _mapHash || header.width != _gridWidth || header.height != _gridHeight || header.doorCount != doors.size()) {
+        printf("Map changed since the path map store was written, rebuilding\n");
+        return false;
+    }
+    size_t cells = (size_t)header.width * header.height;
+    size_t matchesAt = sizeof(PathMapStoreHeader) + header.doorCount * cells * sizeof(int16_t);
+    size_t idsAt = matchesAt + header.doorCount * sizeof(uint32_t);
+    if (file->size() < idsAt + header.matchCount * sizeof(int32_t)) {
+        printf("Path map store is truncated, rebuilding\n");
+        return false;
+    }
 
-    for (int x = 0; x < pathMap.size(); x++) {
-        for (int y = 0; y < pathMap[x].size(); y++) {
-            glm::vec2 here = { x, y };
-            for (const ci::Shape2d& inBound : inBounds) {
-                if (inBound.contains(here)) {
-                    pathMap[x][y] = -1;
-                    break;
-                }
-            }
-            if (bounding) {
-                for (const DeviceView& devView : devs) {
-                    if (devView.id != excludeDev && devView.view.contains(here)) {
-                        pathMap[x][y] = -devView.id - 3;
-                        break;
-                    }
-                }
+    // the matches follow int16 cells, so they may be unaligned
+    std::vector<std::set<int>> doorMatches(header.doorCount);
+    size_t matched = 0;
+    for (int i = 0; i < header.doorCount; i++) {
+        uint32_t count;
+        memcpy(&count, file->data() + matchesAt + i * sizeof(uint32_t), sizeof(count));
+        if (count > header.matchCount - matched) {
+            printf("Path map store has bad door matches, rebuilding\n");
+            return false;
+        }
+        for (uint32_t j = 0; j < count; j++, matched++) {
+            int32_t dev;
+            memcpy(&dev, file->data() + idsAt + matched * sizeof(int32_t), sizeof(dev));
+            doorMatches[i].insert(dev);
+        }
+    }
+
+    printf("Mapping path map store\n");
+    const int16_t* pathMap = reinterpret_cast<const int16_t*>(file->data() + sizeof(PathMapStoreHeader));
+    _pathMaps.clear();
+    for (int i = 0; i < header.doorCount; i++, pathMap += cells) {
+        _pathMaps.push_back(PathMap(_gridWidth, _gridHeight, pathMap, file));
+    }
+    _doorMatches.swap(doorMatches);
+    return true;
+}
+
+bool Map::writeStore(const std::string& storePath) const {
+    PathMapStoreHeader header = {};
+    memcpy(header.magic, PATH_MAP_STORE_MAGIC, sizeof(header.magic));
+    header.version = PATH_MAP_STORE_VERSION;
+    header.width = _gridWidth;
+    header.height = _gridHeight;
+    header.mapHash = _mapHash;
+    header.doorCount = _pathMaps.size();
+    for (const std::set<int>& matches : _doorMatches) {
+        header.matchCount += matches.size();
+    }
+
+    size_t bytesPerMap = (size_t)_gridWidth * _gridHeight * sizeof(int16_t);
+    bool written = replaceFile(storePath, [&](std::ostream& file) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const PathMap& pathMap : _pathMaps) {
+            file.write(reinterpret_cast<const char*>(pathMap.data()), bytesPerMap);
+        }
+        for (const std::set<int>& matches : _doorMatches) {
+            uint32_t count = matches.size();
+            file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        }
+        for (const std::set<int>& matches : _doorMatches) {
+            for (int32_t dev : matches) {
+                file.write(reinterpret_cast<const char*>(&dev), sizeof(dev));
             }
-            for (const ci::Shape2d& outBound : outBounds) {
-                if (outBound.contains(here)) {
-                    pathMap[x][y] = -2;
+        }
+        return file.good();
+    });
+    if (!written) {
+        std::cerr << "Map::writeStore - Error: Couldn't write path map store " << storePath << ", path maps are rebuilt on every start until it can be" << std::endl;
+    }
+    return written;
+}
+
+const PathMap* Map::getPathMap(int room) const { return &_pathMaps[room]; }
+PathMap Map::getDevicePathMap(int dev) const {
+    std::vector<int16_t> pathMap;
+    createPathMap(pathMap, devs[dev].pos);
+    return PathMap(_gridWidth, _gridHeight, std::move(pathMap));
+}
+
+void Map::createPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end) const {
+    fillPathMap(pathMap, end, nullptr, -1);
+}
+
+void Map::createPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end, std::set<int>& boundingDevs, int excludeDev) const {
+    fillPathMap(pathMap, end, &boundingDevs, excludeDev);
+}
+
+void Map::fillPathMap(std::vector<int16_t>& pathMap, glm::ivec2 end, std::set<int>* boundingDevs, int excludeDev) const {
+
+    bool bounding = boundingDevs != nullptr;
+
+    // flat x major grid like PathMap, cell (x, y) is at x * height + y
+    int width = _gridWidth;
+    int height = _gridHeight;
+    std::vector<int16_t>& grid = pathMap;
+    grid.resize(width * height);
+
+    for (int cell = 0; cell < grid.size(); cell++) {
+        uint16_t label = _cells[cell];
+        grid[cell] = (label & CELL_OPEN) ? -1 : -2;
+        if (bounding) {
+            for (int dev : _coverage[label & CELL_COVERAGE]) {
+                if (devs[dev].id != excludeDev) {
+                    grid[cell] = -devs[dev].id - 3;
                     break;
                 }
             }
         }
     }
 
-    pathMap[end.x][end.y] = 0;
-
-    int set = 0;
-    while (1) {
-        auto pathMapCopy = pathMap;
-        int setNow = 0;
-        for (int x = 0; x < pathMap.size(); x++) {
-            for (int y = 0; y < pathMap[x].size(); y++) {
-                if (pathMap[x][y] >= 0) {
-                    setNow++;
-                    for (int i = -1; i < 2; i++) {
-                        for (int j = -1; j < 2; j++) {
-                            if (!(i == 0 && j == 0) &&
-                                x + i >= 0 && x + i < pathMap.size() &&
-                                y + j >= 0 && y + j < pathMap[x].size()) {
-                                
-                                int adjVal = pathMap[x + i][y + j];
-                                if (adjVal == -1) {
-                                    pathMapCopy[x + i][y + j] = pathMap[x][y] + 1;
-                                }
-                                if (bounding && adjVal < -2) {
-                                    int devId = -adjVal - 3;
-                                    boundingDevs.insert(devId);
-                                    if (devs[devId].pair != -1) {
-                                        boundingDevs.insert(devs[devId].pair);
-                                    }
-                                }
-                            }
-                        }
+    // Every step costs 1, diagonals included, so a breadth first flood from the
+    // end reaches each open (-1) cell at its final distance. Each cell is queued
+    // once, the queue is just the visit order.
+    std::vector<int> queue;
+    queue.reserve(grid.size());
+    queue.push_back(end.x * height + end.y);
+    grid[queue[0]] = 0;
+
+    for (size_t head = 0; head < queue.size(); head++) {
+        int x = queue[head] / height;
+        int y = queue[head] % height;
+        int next = grid[queue[head]] + 1;
+        // past what a cell can hold, leave the rest unreachable
+        if (next > INT16_MAX) break;
+        for (int i = -1; i < 2; i++) {
+            if (x + i < 0 || x + i >= width) continue;
+            for (int j = -1; j < 2; j++) {
+                if ((i == 0 && j == 0) || y + j < 0 || y + j >= height) continue;
+
+                int adj = (x + i) * height + y + j;
+                int adjVal = grid[adj];
+                if (adjVal == -1) {
+                    grid[adj] = next;
+                    queue.push_back(adj);
+                }
+                if (bounding && adjVal < -2) {
+                    int devId = -adjVal - 3;
+                    boundingDevs->insert(devId);
+                    if (devs[devId].pair != -1) {
+                        boundingDevs->insert(devs[devId].pair);
                     }
                 }
             }
         }
-        pathMap = pathMapCopy;
-        if (setNow == set) break;
-        set = setNow;
     }
 }
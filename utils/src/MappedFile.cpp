@@ -0,0 +1,98 @@
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#include <fmt/core.h>
+
+#include "utils/MappedFile.h"
+
+// Attempts at renaming a new file into place, and the wait between them
+#define REPLACE_FILE_TRIES 10
+#define REPLACE_FILE_RETRY_MS 100
+
+uint64_t hashFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good()) return 0;
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= (unsigned char)buffer[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+std::string versionedPath(const std::string& path, uint32_t version, uint64_t hash) {
+    std::filesystem::path versioned(path);
+    versioned.replace_filename(fmt::format("{}.v{}-{:016x}{}", versioned.stem().string(), version, hash, versioned.extension().string()));
+    return versioned.string();
+}
+
+void removeOtherVersions(const std::string& path, const std::string& keep) {
+    std::filesystem::path base(path);
+    std::string prefix = base.stem().string() + ".v";
+    std::filesystem::path dir = base.has_parent_path() ? base.parent_path() : std::filesystem::path(".");
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind(prefix, 0) != 0 || entry.path().extension() != base.extension()) continue;
+        if (entry.path().filename() == std::filesystem::path(keep).filename()) continue;
+        // a version still mapped elsewhere stays until a later run
+        std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+bool replaceFile(const std::string& path, const std::vector<char>& bytes) {
+    return replaceFile(path, [&](std::ostream& file) {
+        file.write(bytes.data(), bytes.size());
+        return true;
+    });
+}
+
+bool replaceFile(const std::string& path, const std::function<bool(std::ostream&)>& write) {
+    // unique so processes building the same cache at once don't write into one file
+    std::string tmpPath = fmt::format("{}.{:x}.tmp", path, std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            std::cerr << "replaceFile: Error: can't create " << tmpPath << std::endl;
+            return false;
+        }
+        if (!write(file) || !file.flush().good()) {
+            std::cerr << "replaceFile: Error: can't write " << tmpPath << std::endl;
+            file.close();
+            std::error_code ec;
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    for (int attempt = 0; attempt < REPLACE_FILE_TRIES; attempt++) {
+        if (attempt > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLACE_FILE_RETRY_MS));
+        }
+        std::filesystem::rename(tmpPath, path, ec);
+        if (!ec) return true;
+    }
+    std::cerr << "replaceFile: Error: can't replace " << path << " after " << REPLACE_FILE_TRIES << " tries: " << ec.message() << std::endl;
+    std::filesystem::remove(tmpPath, ec);
+    return false;
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec) || std::filesystem::file_size(path, ec) == 0) return;
+    try {
+        _file = boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+        _region = boost::interprocess::mapped_region(_file, boost::interprocess::read_only);
+        _valid = true;
+    }
+    catch (const boost::interprocess::interprocess_exception& err) {
+        std::cerr << "MappedFile: can't map " << path << ": " << err.what() << std::endl;
+    }
+}
@@ -1,23 +1,49 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
 
 #include <fmt/core.h>
 
 #include "utils/PathGraph.h"
 
-std::vector<std::set<int>> PathGraph::_graph;
-Eigen::MatrixXd PathGraph::_distances;
+#define PATH_GRAPH_CACHE_MAGIC "FAPGRAPH"
+
+int PathGraph::_nodeCount = 0;
+const uint32_t* PathGraph::_offsets = nullptr;
+const int32_t* PathGraph::_edges = nullptr;
+const double* PathGraph::_distances = nullptr;
+
+std::unique_ptr<MappedFile> PathGraph::_cacheFile;
+std::vector<uint32_t> PathGraph::_ownedOffsets;
+std::vector<int32_t> PathGraph::_ownedEdges;
+Eigen::MatrixXd PathGraph::_ownedDistances;
+
+static size_t alignTo8(size_t bytes) { return (bytes + 7) & ~size_t(7); }
 
 PathGraph::PathGraph(int stsId_, int ltsId_, int period_, boost::span<const unsigned char> path) :
     shortTermStateId(stsId_),
     longTermStateId(ltsId_),
     period(period_)
 {
-    if (_graph.size() == 0) {
+    if (_nodeCount == 0) {
         printf("PathGraph::PathGraph - Error: PathGraph uninitlized\n");
     }
 
-    _depths = Eigen::VectorXi::Zero(_graph.size());
-    if (path.size() > 0) {
-	    memcpy(_depths.data(), path.data(), path.size_bytes());
+    _depths = Eigen::VectorXi::Zero(_nodeCount);
+    int32_t tag = 0;
+    if (path.size() >= sizeof(int32_t)) {
+        memcpy(&tag, path.data(), sizeof(int32_t));
+    }
+    if (tag == PATH_SPARSE_TAG) {
+        for (size_t offset = sizeof(int32_t); offset + 2 * sizeof(int32_t) <= path.size(); offset += 2 * sizeof(int32_t)) {
+            int32_t entry[2];
+            memcpy(entry, path.data() + offset, sizeof(entry));
+            if (entry[0] >= 0 && entry[0] < _depths.size()) {
+                _depths[entry[0]] = entry[1];
+            }
+        }
+    } else if (path.size() > 0) {
+	    memcpy(_depths.data(), path.data(), std::min(path.size_bytes(), (size_t)_depths.size() * sizeof(int)));
     }
 }
 
@@ -25,96 +51,117 @@ void PathGraph::initGraph(std::string mapPath, std::string cachePath) {
     
     printf("Initilizing path graph ... \n");
 
-    std::ifstream cacheIn;
-    cacheIn.open(cachePath.c_str());
-    if (!cacheIn.good()) {
-        cacheIn.close();
-
+    uint64_t mapHash = hashFile(mapPath);
+    // each map and format gets its own file, the one other processes may have mapped is left alone
+    std::string path = versionedPath(cachePath, PATH_GRAPH_CACHE_VERSION, mapHash);
+    if (!loadCache(path, mapHash)) {
         printf("Getting connections\n");
 
+        std::vector<std::set<int>> conns;
+        Eigen::MatrixXd distances;
         Map map(mapPath);
-	    map.getDeviceConnections(_graph, _distances);
+	    map.getDeviceConnections(conns, distances);
+        initGraph(conns, distances);
 
         printf("Writing to cache\n");
-        std::ofstream cacheOut;
-        cacheOut.open(cachePath);
-        if (cacheOut.good()) {
-            for (std::set<int>& conns : _graph) {
-                for (auto i = conns.begin(); i != conns.end(); i++) {
-                    cacheOut << std::to_string(*i);
-                    if (i != --conns.end()) {
-                        cacheOut << ", ";
-                    }
-                }
-                cacheOut << "\n";
-            }
-
-            cacheOut << "distances\n";
-            for (int row = 0; row < _distances.rows(); row++) {
-                for (int col = 0; col < _distances.cols(); col++) {
-                    cacheOut << std::to_string(_distances(row, col));
-                    if (col != _distances.cols() - 1) {
-                        cacheOut << ", ";
-                    }
-                }
-                cacheOut << "\n";
-            }
-        }
-        cacheOut.close();
-    } else {
-        printf("Reading cache\n");
-        std::string line;
-        bool readingDistances = false;
-        int distancesRow = 0;
-        while (1) {
-            std::getline(cacheIn, line);
-            if (line == "distances") {
-                readingDistances = true;
-                _distances = Eigen::MatrixXd::Zero(_graph.size(), _graph.size());
-                continue;
-            }
-            if (cacheIn.eof()) break;
-            std::stringstream s(line);
-            std::string num;
-            if (!readingDistances) {
-                std::set<int> conns;
-                while (std::getline(s, num, ',')) {
-                    conns.emplace(stoi(num));
-                }
-                _graph.push_back(conns);
-            } else {
-                int col = 0;
-                while (std::getline(s, num, ',')) {
-                    _distances(distancesRow, col) = stof(num);
-                    col++;
-                }
-                distancesRow++;
-            }
+        if (writeCache(path, mapHash)) {
+            removeOtherVersions(cachePath, path);
         }
-        cacheIn.close();
     }
     printf("Done\n");
 }
 
+void PathGraph::initGraph(const std::vector<std::set<int>>& conns, const Eigen::MatrixXd& distances) {
+    _cacheFile.reset();
+    _nodeCount = conns.size();
+    _ownedOffsets.assign(1, 0);
+    _ownedEdges.clear();
+    for (const std::set<int>& nodeConns : conns) {
+        _ownedEdges.insert(_ownedEdges.end(), nodeConns.begin(), nodeConns.end());
+        _ownedOffsets.push_back(_ownedEdges.size());
+    }
+    _ownedDistances = distances;
+    _offsets = _ownedOffsets.data();
+    _edges = _ownedEdges.data();
+    _distances = _ownedDistances.data();
+}
+
+bool PathGraph::loadCache(const std::string& cachePath, uint64_t mapHash) {
+    std::unique_ptr<MappedFile> file(new MappedFile(cachePath));
+    if (!file->valid() || file->size() < sizeof(PathGraphCacheHeader)) {
+        return false;
+    }
+    PathGraphCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, PATH_GRAPH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PATH_GRAPH_CACHE_VERSION) {
+        printf("Path graph cache is from another version, rebuilding\n");
+        return false;
+    }
+    if (header.mapHash != mapHash) {
+        printf("Map changed since the path graph cache was written, rebuilding\n");
+        return false;
+    }
+    size_t offsetsAt = sizeof(PathGraphCacheHeader);
+    size_t edgesAt = offsetsAt + (header.nodeCount + 1) * sizeof(uint32_t);
+    size_t distancesAt = alignTo8(edgesAt + header.edgeCount * sizeof(int32_t));
+    size_t end = distancesAt + (size_t)header.nodeCount * header.nodeCount * sizeof(double);
+    if (file->size() < end) {
+        printf("Path graph cache is truncated, rebuilding\n");
+        return false;
+    }
+
+    printf("Mapping cache\n");
+    _cacheFile = std::move(file);
+    _nodeCount = header.nodeCount;
+    _offsets = reinterpret_cast<const uint32_t*>(_cacheFile->data() + offsetsAt);
+    _edges = reinterpret_cast<const int32_t*>(_cacheFile->data() + edgesAt);
+    _distances = reinterpret_cast<const double*>(_cacheFile->data() + distancesAt);
+    return true;
+}
+
+bool PathGraph::writeCache(const std::string& cachePath, uint64_t mapHash) {
+    PathGraphCacheHeader header = {};
+    memcpy(header.magic, PATH_GRAPH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PATH_GRAPH_CACHE_VERSION;
+    header.nodeCount = _nodeCount;
+    header.mapHash = mapHash;
+    header.edgeCount = _offsets[_nodeCount];
+
+    size_t offsetsAt = sizeof(PathGraphCacheHeader);
+    size_t edgesAt = offsetsAt + (_nodeCount + 1) * sizeof(uint32_t);
+    size_t distancesAt = alignTo8(edgesAt + header.edgeCount * sizeof(int32_t));
+    std::vector<char> bytes(distancesAt + (size_t)_nodeCount * _nodeCount * sizeof(double), 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + offsetsAt, _offsets, (_nodeCount + 1) * sizeof(uint32_t));
+    memcpy(bytes.data() + edgesAt, _edges, header.edgeCount * sizeof(int32_t));
+    memcpy(bytes.data() + distancesAt, _distances, (size_t)_nodeCount * _nodeCount * sizeof(double));
+    if (!replaceFile(cachePath, bytes)) {
+        std::cerr << "PathGraph::writeCache - Error: Couldn't write path graph cache " << cachePath << ", the graph is rebuilt on every start until it can be" << std::endl;
+        return false;
+    }
+    return true;
+}
+
 size_t PathGraph::getPathByteSize() {
-    if (_graph.size() == 0) {
+    if (_nodeCount == 0) {
         printf("PathGraph:getPathByteSize - Error: PathGraph uninitalized\n");
     }
-    return _graph.size() * sizeof(float);
+    return _nodeCount * sizeof(float);
 }
 
-std::set<int> PathGraph::getGraphEdges(int node) {
-    if (_graph.size() == 0) {
-        printf("PathGraph:getPathByteSize - Error: PathGraph uninitalized\n");
+boost::span<const int32_t> PathGraph::getGraphEdges(int node) {
+    if (_nodeCount == 0) {
+        printf("PathGraph:getGraphEdges - Error: PathGraph uninitalized\n");
     }
-    if (_graph.size() > node) {
-        return _graph[node];
+    if (node >= 0 && node < _nodeCount) {
+        return boost::span<const int32_t>(_edges + _offsets[node], _offsets[node + 1] - _offsets[node]);
     }
-    return std::set<int>();
+    return boost::span<const int32_t>();
 }
 
 double PathGraph::getGraphEdgeLength(int from, int to) {
-    double distance = _distances(from, to);
+    // column major, as Eigen stores it
+    double distance = _distances[(size_t)to * _nodeCount + from];
     if (distance == 0.0) {
         fmt::println("PathGraph:getGraphEdgeLength - Error: Can't get edge length from {} to {}", from, to);
     }
@@ -134,7 +181,7 @@ void PathGraph::fuse(PathGraphPtr other) {
     _depths += other->getDepths();
 }
 
-int PathGraph::getFinalDev() {
+int PathGraph::getFinalDev() const {
     // this might not be the right solution
     int lowest = 0;
     for (int i = 1; i < _depths.size(); i++) {
@@ -145,19 +192,36 @@ int PathGraph::getFinalDev() {
     return lowest;
 }
 
-int PathGraph::getNext(int node) {
-    std::set<int> conns = _graph[node];
+int PathGraph::getNext(int node) const {
     int lowest = -1;
     int lowestDepth = 0;
-    for (auto i = conns.begin(); i != conns.end(); i++) {
-        if (_depths[*i] < lowestDepth) {
-            lowest = *i;
-            lowestDepth = _depths[*i];
+    for (int32_t next : getGraphEdges(node)) {
+        if (_depths[next] < lowestDepth) {
+            lowest = next;
+            lowestDepth = _depths[next];
         }
     }
     return lowest;
 }
 
+std::vector<UCHAR> PathGraph::encode() const {
+    boost::span<UCHAR> dense = getPathSpan();
+#ifdef PATH_SPARSE_ENCODING
+    std::vector<int32_t> sparse = { PATH_SPARSE_TAG };
+    for (int node = 0; node < _depths.size(); node++) {
+        if (_depths[node] != 0) {
+            sparse.push_back(node);
+            sparse.push_back(_depths[node]);
+        }
+    }
+    if (sparse.size() * sizeof(int32_t) < dense.size()) {
+        const UCHAR* bytes = reinterpret_cast<const UCHAR*>(sparse.data());
+        return std::vector<UCHAR>(bytes, bytes + sparse.size() * sizeof(int32_t));
+    }
+#endif
+    return std::vector<UCHAR>(dense.begin(), dense.end());
+}
+
 const boost::span<UCHAR> PathGraph::getPathSpan() const { return boost::span<UCHAR>(reinterpret_cast<UCHAR*>(const_cast<int*>(_depths.data())), getPathByteSize()); }
 const Eigen::VectorXi& PathGraph::getDepths() const {return _depths;}
-int PathGraph::getDepth(int node) {return _depths(node);}
\ No newline at end of file
+int PathGraph::getDepth(int node) const {return _depths(node);}
\ No newline at end of file
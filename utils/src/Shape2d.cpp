@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "utils/Shape2d.h"
+
+// Arc segments span at most this, keeping a 20 ft camera arc within 0.01 ft
+#define ARC_SEGMENT_RADIANS 0.035f
+
+void Shape2d::moveTo(glm::vec2 point) {
+    _points.clear();
+    _points.push_back(point);
+}
+
+void Shape2d::lineTo(glm::vec2 point) {
+    _points.push_back(point);
+}
+
+void Shape2d::arc(glm::vec2 center, float radius, float startRadians, float endRadians) {
+    int segments = std::max(1, (int)std::ceil(std::abs(endRadians - startRadians) / ARC_SEGMENT_RADIANS));
+    for (int i = 0; i <= segments; i++) {
+        float angle = startRadians + (endRadians - startRadians) * i / segments;
+        _points.push_back(center + radius * glm::vec2(std::cos(angle), std::sin(angle)));
+    }
+}
+
+void Shape2d::transform(const glm::mat3& trans) {
+    for (glm::vec2& point : _points) {
+        glm::vec3 moved = trans * glm::vec3(point, 1.0f);
+        point = glm::vec2(moved.x, moved.y);
+    }
+}
+
+bool Shape2d::contains(glm::vec2 point) const {
+    bool inside = false;
+    for (size_t i = 0, j = _points.size() - 1; i < _points.size(); j = i++) {
+        const glm::vec2& a = _points[i];
+        const glm::vec2& b = _points[j];
+        if ((a.y > point.y) != (b.y > point.y) &&
+            point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+Rect2d Shape2d::calcBoundingBox() const {
+    float max = std::numeric_limits<float>::max();
+    Rect2d box = { max, max, -max, -max };
+    for (const glm::vec2& point : _points) {
+        box.x1 = std::min(box.x1, point.x);
+        box.y1 = std::min(box.y1, point.y);
+        box.x2 = std::max(box.x2, point.x);
+        box.y2 = std::max(box.y2, point.y);
+    }
+    return box;
+}
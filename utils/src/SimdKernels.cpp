@@ -0,0 +1,93 @@
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "utils/SimdKernels.h"
+
+static void accumulateSquaredDiff(const float* row, float q, float* out, int n) {
+    for (int i = 0; i < n; i++) {
+        float d = row[i] - q;
+        out[i] += d * d;
+    }
+}
+
+static void dotTile(const float* a, const float* panel, size_t stride, int cols, int features, float* out) {
+    // a feature at a time, so the inner loop still runs along contiguous columns
+    for (int c = 0; c < cols; c++) {
+        out[c] = 0.0f;
+    }
+    for (int k = 0; k < features; k++) {
+        const float* p = panel + k * stride;
+        for (int c = 0; c < cols; c++) {
+            out[c] += a[k] * p[c];
+        }
+    }
+}
+
+static int crowdStep(const CrowdArrays&, int begin, int, float) {
+    return begin;
+}
+
+static const SimdKernels SCALAR_KERNELS = { SIMD_SCALAR, accumulateSquaredDiff, dotTile, crowdStep };
+
+const SimdKernels* scalarKernels() { return &SCALAR_KERNELS; }
+
+#if !defined(FA_SIMD_AVX2)
+const SimdKernels* avx2Kernels() { return nullptr; }
+#endif
+#if !defined(FA_SIMD_AVX512)
+const SimdKernels* avx512Kernels() { return nullptr; }
+#endif
+
+// Instruction sets the CPU and OS both support, AVX2 counting only with FMA
+static SimdLevel cpuLevel() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return SIMD_SCALAR;
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    bool fma = info[2] & (1 << 12);
+    if (!osxsave) return SIMD_SCALAR;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    bool avx2 = fma && (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+    bool avx512 = avx2 && (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+    return avx512 ? SIMD_AVX512 : avx2 ? SIMD_AVX2 : SIMD_SCALAR;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool avx512 = avx2 && __builtin_cpu_supports("avx512f");
+    return avx512 ? SIMD_AVX512 : avx2 ? SIMD_AVX2 : SIMD_SCALAR;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// Each level only fills in the kernels it speeds up, the rest come from the level below
+static SimdKernels pickKernels() {
+    SimdLevel cpu = cpuLevel();
+    SimdKernels kernels = SCALAR_KERNELS;
+    const SimdKernels* levels[2] = { cpu >= SIMD_AVX2 ? avx2Kernels() : nullptr, cpu >= SIMD_AVX512 ? avx512Kernels() : nullptr };
+    for (const SimdKernels* level : levels) {
+        if (level == nullptr) continue;
+        kernels.level = level->level;
+        if (level->accumulateSquaredDiff) kernels.accumulateSquaredDiff = level->accumulateSquaredDiff;
+        if (level->dotTile) kernels.dotTile = level->dotTile;
+        if (level->crowdStep) kernels.crowdStep = level->crowdStep;
+    }
+    return kernels;
+}
+
+const SimdKernels& simdKernels() {
+    static const SimdKernels kernels = pickKernels();
+    return kernels;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SIMD_AVX512: return "avx512";
+    case SIMD_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
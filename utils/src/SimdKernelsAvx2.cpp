@@ -0,0 +1,97 @@
+// Built with AVX2 and FMA. Keep to intrinsics and plain loops here: an inline
+// or template function from any header would be compiled with AVX2 too, and the
+// linker may pick that copy for callers on CPUs without it.
+#include <immintrin.h>
+
+#include "utils/SimdKernels.h"
+
+static void accumulateSquaredDiff(const float* row, float q, float* out, int n) {
+    int i = 0;
+    __m256 q8 = _mm256_set1_ps(q);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(row + i), q8);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(d, d, _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) {
+        float d = row[i] - q;
+        out[i] += d * d;
+    }
+}
+
+static void dotTile(const float* a, const float* panel, size_t stride, int cols, int features, float* out) {
+    int c = 0;
+    for (; c + 32 <= cols; c += 32) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (int k = 0; k < features; k++) {
+            __m256 ak = _mm256_set1_ps(a[k]);
+            const float* p = panel + k * stride + c;
+            acc0 = _mm256_fmadd_ps(ak, _mm256_loadu_ps(p), acc0);
+            acc1 = _mm256_fmadd_ps(ak, _mm256_loadu_ps(p + 8), acc1);
+            acc2 = _mm256_fmadd_ps(ak, _mm256_loadu_ps(p + 16), acc2);
+            acc3 = _mm256_fmadd_ps(ak, _mm256_loadu_ps(p + 24), acc3);
+        }
+        _mm256_storeu_ps(out + c, acc0);
+        _mm256_storeu_ps(out + c + 8, acc1);
+        _mm256_storeu_ps(out + c + 16, acc2);
+        _mm256_storeu_ps(out + c + 24, acc3);
+    }
+    for (int j = c; j < cols; j++) {
+        out[j] = 0.0f;
+    }
+    for (int k = 0; k < features; k++) {
+        const float* p = panel + k * stride;
+        for (int j = c; j < cols; j++) {
+            out[j] += a[k] * p[j];
+        }
+    }
+}
+
+static int crowdStep(const CrowdArrays& crowd, int begin, int end, float dt) {
+    int i = begin;
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 dt8 = _mm256_set1_ps(dt);
+    const __m256i none = _mm256_set1_epi32(-1);
+    const __m256i width8 = _mm256_set1_epi32(crowd.width);
+    const __m256i height8 = _mm256_set1_epi32(crowd.height);
+    const __m256i cells8 = _mm256_set1_epi32(crowd.width * crowd.height);
+    const __m256i stop8 = _mm256_set1_epi32(crowd.stop);
+    const __m256i byte8 = _mm256_set1_epi32(0xff);
+    const __m256 dirX = _mm256_loadu_ps(crowd.dirX);
+    const __m256 dirY = _mm256_loadu_ps(crowd.dirY);
+    const __m256 dirHeading = _mm256_loadu_ps(crowd.dirHeading);
+    const int* flow = reinterpret_cast<const int*>(crowd.flow);
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(crowd.x + i);
+        __m256 y = _mm256_loadu_ps(crowd.y + i);
+        __m256i door = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(crowd.target + i));
+        __m256i ix = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, half)));
+        __m256i iy = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, half)));
+
+        // lanes walking somewhere and on the map
+        __m256i valid = _mm256_cmpgt_epi32(door, none);
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(ix, none));
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(width8, ix));
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(iy, none));
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(height8, iy));
+
+        // gather the 4 bytes at each flow entry and keep the first
+        __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(door, cells8), _mm256_add_epi32(_mm256_mullo_epi32(ix, height8), iy));
+        __m256i dir = _mm256_and_si256(_mm256_mask_i32gather_epi32(stop8, flow, cell, valid, 1), byte8);
+        __m256 moving = _mm256_castsi256_ps(_mm256_cmpgt_epi32(stop8, dir));
+
+        __m256 dx = _mm256_and_ps(_mm256_mul_ps(_mm256_permutevar8x32_ps(dirX, dir), dt8), moving);
+        __m256 dy = _mm256_and_ps(_mm256_mul_ps(_mm256_permutevar8x32_ps(dirY, dir), dt8), moving);
+        _mm256_storeu_ps(crowd.x + i, _mm256_add_ps(x, dx));
+        _mm256_storeu_ps(crowd.y + i, _mm256_add_ps(y, dy));
+        __m256 heading = _mm256_loadu_ps(crowd.heading + i);
+        _mm256_storeu_ps(crowd.heading + i, _mm256_blendv_ps(heading, _mm256_permutevar8x32_ps(dirHeading, dir), moving));
+    }
+    return i;
+}
+
+static const SimdKernels AVX2_KERNELS = { SIMD_AVX2, accumulateSquaredDiff, dotTile, crowdStep };
+
+const SimdKernels* avx2Kernels() { return &AVX2_KERNELS; }
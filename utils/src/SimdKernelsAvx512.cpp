@@ -0,0 +1,47 @@
+// Built with AVX-512F and FMA, same rules as SimdKernelsAvx2.cpp. The crowd
+// step has no AVX-512 version and comes from the AVX2 table.
+#include <immintrin.h>
+
+#include "utils/SimdKernels.h"
+
+static void accumulateSquaredDiff(const float* row, float q, float* out, int n) {
+    int i = 0;
+    __m512 q16 = _mm512_set1_ps(q);
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(row + i), q16);
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(d, d, _mm512_loadu_ps(out + i)));
+    }
+    for (; i < n; i++) {
+        float d = row[i] - q;
+        out[i] += d * d;
+    }
+}
+
+static void dotTile(const float* a, const float* panel, size_t stride, int cols, int features, float* out) {
+    int c = 0;
+    for (; c + 32 <= cols; c += 32) {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for (int k = 0; k < features; k++) {
+            __m512 ak = _mm512_set1_ps(a[k]);
+            const float* p = panel + k * stride + c;
+            acc0 = _mm512_fmadd_ps(ak, _mm512_loadu_ps(p), acc0);
+            acc1 = _mm512_fmadd_ps(ak, _mm512_loadu_ps(p + 16), acc1);
+        }
+        _mm512_storeu_ps(out + c, acc0);
+        _mm512_storeu_ps(out + c + 16, acc1);
+    }
+    for (int j = c; j < cols; j++) {
+        out[j] = 0.0f;
+    }
+    for (int k = 0; k < features; k++) {
+        const float* p = panel + k * stride;
+        for (int j = c; j < cols; j++) {
+            out[j] += a[k] * p[j];
+        }
+    }
+}
+
+static const SimdKernels AVX512_KERNELS = { SIMD_AVX512, accumulateSquaredDiff, dotTile, nullptr };
+
+const SimdKernels* avx512Kernels() { return &AVX512_KERNELS; }
@@ -0,0 +1,100 @@
+#include <fmt/core.h>
+
+#include "utils/StateCache.h"
+
+StateCache::StateCache(FaceIndexType indexType) : _longTermIndex(FaceIndex::create(indexType)) {}
+
+void StateCache::sync(DBConnection& db, int epoch) {
+    {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        if (_loaded && epoch == _epoch) return;
+    }
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    if (_loaded && epoch == _epoch) return;
+    if (_loaded) {
+        fmt::println("State epoch changed from {} to {}, reloading states", _epoch, epoch);
+    }
+    _epoch = epoch;
+    load(db);
+}
+
+void StateCache::invalidate() {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    _loaded = false;
+}
+
+void StateCache::setIndexType(FaceIndexType indexType) {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    _longTermIndex = FaceIndex::create(indexType);
+    _longTermStatesById.clear();
+    _loaded = false;
+}
+
+LongTermStatePtr StateCache::getLongTermState(int id) const {
+    auto lts = _longTermStatesById.find(id);
+    if (lts == _longTermStatesById.end()) return nullptr;
+    return lts->second;
+}
+
+void StateCache::addShortTermState(ShortTermStatePtr sts) {
+    if (sts == nullptr) return;
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    _shortTermIndex[sts->id] = _shortTermMeans.add(sts->facialFeatures);
+    _shortTermStates.push_back(sts);
+}
+
+void StateCache::updateMean(ShortTermStatePtr sts) {
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+    auto index = _shortTermIndex.find(sts->id);
+    if (index != _shortTermIndex.end()) {
+        _shortTermMeans.set(index->second, sts->facialFeatures);
+    }
+}
+
+void StateCache::commitShortTermState(DBConnection& db, ShortTermStatePtr sts) {
+    updateMean(sts);
+    db.updateShortTermState(sts);
+}
+
+void StateCache::commitShortTermState(UnitOfWork& work, ShortTermStatePtr sts) {
+    updateMean(sts);
+    work.updateShortTermState(sts);
+}
+
+void StateCache::revertShortTermState(ShortTermStatePtr sts, const ShortTermState& previous) {
+    *sts = previous;
+    updateMean(sts);
+}
+
+void StateCache::load(DBConnection& db) {
+    _shortTermStates.clear();
+    _longTermStates.clear();
+    _shortTermIndex.clear();
+    _shortTermMeans.clear();
+
+    db.getShortTermStates(_shortTermStates);
+    db.getLongTermStates(_longTermStates);
+    for (ShortTermStatePtr& sts : _shortTermStates) {
+        _shortTermIndex[sts->id] = _shortTermMeans.add(sts->facialFeatures);
+    }
+
+    // long term states mostly survive a reload, so patch the index in place
+    // rather than rebuilding it
+    std::map<int, LongTermStatePtr> previous;
+    previous.swap(_longTermStatesById);
+    for (LongTermStatePtr& lts : _longTermStates) {
+        _longTermStatesById[lts->id] = lts;
+        auto old = previous.find(lts->id);
+        if (old == previous.end() || old->second->facialFeatures != lts->facialFeatures) {
+            _longTermIndex->update(lts->id, lts->facialFeatures);
+        }
+    }
+    for (auto& old : previous) {
+        if (_longTermStatesById.find(old.first) == _longTermStatesById.end()) {
+            _longTermIndex->remove(old.first);
+        }
+    }
+
+    fmt::println("Cached {} short term states and {} long term states", _shortTermStates.size(), _longTermStates.size());
+    _loaded = true;
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <iostream>
+#include <atomic>
+#include <memory>
+
+#include "utils/ThreadPool.h"
+
+static thread_local int poolWorkerIndex = -1;
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; i++) {
+        _threads.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _taskReady.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push(std::move(task));
+    }
+    _taskReady.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _tasks.empty() && _active == 0; });
+}
+
+void ThreadPool::parallelFor(int n, const std::function<void(int)>& fn) {
+    if (n <= 0) return;
+    // a few chunks per thread evens out uneven work without queueing n tasks
+    int chunks = std::min(n, size() * 4);
+    // Completion is counted per call rather than with wait(), so calls from inside a
+    // pool task or from several threads at once only wait for their own chunks. The
+    // caller claims chunks too, so the call finishes even when every worker is busy.
+    struct Progress {
+        std::atomic<int> next{ 0 };
+        int done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto progress = std::make_shared<Progress>();
+    auto run = [progress, chunks, n, &fn] {
+        int ran = 0;
+        for (int chunk = progress->next++; chunk < chunks; chunk = progress->next++, ran++) {
+            int begin = (long long)n * chunk / chunks;
+            int end = (long long)n * (chunk + 1) / chunks;
+            try {
+                for (int i = begin; i < end; i++) {
+                    fn(i);
+                }
+            }
+            catch (const std::exception& err) {
+                std::cerr << "ThreadPool: parallelFor chunk failed: " << err.what() << std::endl;
+            }
+        }
+        // helpers that start after the last chunk was claimed don't touch fn
+        if (ran == 0) return;
+        std::lock_guard<std::mutex> lock(progress->mutex);
+        progress->done += ran;
+        if (progress->done == chunks) {
+            progress->finished.notify_all();
+        }
+    };
+    for (int helper = 0; helper < std::min(chunks - 1, size()); helper++) {
+        submit(run);
+    }
+    run();
+    std::unique_lock<std::mutex> lock(progress->mutex);
+    progress->finished.wait(lock, [&] { return progress->done == chunks; });
+}
+
+int ThreadPool::workerIndex() {
+    return poolWorkerIndex;
+}
+
+void ThreadPool::work(int index) {
+    poolWorkerIndex = index;
+    while (1) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _taskReady.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+            if (_tasks.empty()) return;
+            task = std::move(_tasks.front());
+            _tasks.pop();
+            _active++;
+        }
+        try {
+            task();
+        }
+        catch (const std::exception& err) {
+            std::cerr << "ThreadPool: task failed: " << err.what() << std::endl;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _active--;
+            if (_tasks.empty() && _active == 0) {
+                _idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "utils/Trace.h"
+
+#define TRACE_MAGIC "FATRACE"
+// How long the replay waits for room when the queue is full
+#define TRACE_QUEUE_FULL_MS 1
+
+TraceWriter::TraceWriter(const std::string& path) : _file(path, std::ios::binary | std::ios::trunc) {
+    if (!_file.good()) {
+        std::cerr << "TraceWriter: can't open " << path << std::endl;
+        return;
+    }
+    TraceHeader header = {};
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.featureSize = FACE_VEC_SIZE;
+    _file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void TraceWriter::write(int64_t timeUs, const std::vector<UpdatePtr>& updates) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const UpdatePtr& update : updates) {
+        TraceRecord record = {};
+        record.timeUs = timeUs;
+        record.deviceId = update->deviceId;
+        memcpy(record.facialFeatures, update->facialFeatures.data(), sizeof(record.facialFeatures));
+        _file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+}
+
+void TraceWriter::flush() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _file.flush();
+}
+
+TraceReader::TraceReader(const std::string& path) : _file(path) {
+    if (!_file.valid() || _file.size() < sizeof(TraceHeader)) {
+        std::cerr << "TraceReader: can't read " << path << std::endl;
+        return;
+    }
+    TraceHeader header;
+    memcpy(&header, _file.data(), sizeof(header));
+    if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION || header.featureSize != FACE_VEC_SIZE) {
+        std::cerr << "TraceReader: " << path << " is not a version " << TRACE_VERSION << " trace" << std::endl;
+        return;
+    }
+    _records = reinterpret_cast<const TraceRecord*>(_file.data() + sizeof(TraceHeader));
+    // a trace cut off mid record still replays up to the last whole one
+    _count = (_file.size() - sizeof(TraceHeader)) / sizeof(TraceRecord);
+}
+
+TraceReplay::TraceReplay(const std::string& path, UpdateQueue& queue, double speed) : _trace(path), _queue(queue), _speed(speed) {}
+
+TraceReplay::~TraceReplay() {
+    stop();
+}
+
+bool TraceReplay::start() {
+    if (!_trace.valid()) return false;
+    if (_speed > 0) {
+        fmt::println("Replaying {} detections at {}x", _trace.size(), _speed);
+    } else {
+        fmt::println("Replaying {} detections at max speed", _trace.size());
+    }
+    _queuedAt.resize(_trace.size());
+    _thread = std::thread([this] {
+        auto start = std::chrono::steady_clock::now();
+        int64_t firstUs = _trace.size() > 0 ? _trace[0].timeUs : 0;
+        for (size_t i = 0; i < _trace.size() && !_stopping; i++) {
+            const TraceRecord& record = _trace[i];
+            if (_speed > 0) {
+                std::chrono::duration<double> due((record.timeUs - firstUs) / 1e6 / _speed);
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due));
+            }
+            boost::span<const UCHAR> features(reinterpret_cast<const UCHAR*>(record.facialFeatures), sizeof(record.facialFeatures));
+            UpdatePtr update(new Update(-int(i) - 1, record.deviceId, features));
+            _queuedAt[i] = std::chrono::steady_clock::now();
+            while (!_queue.push(update) && !_stopping) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_QUEUE_FULL_MS));
+            }
+        }
+        _done = true;
+    });
+    return true;
+}
+
+void TraceReplay::stop() {
+    _stopping = true;
+    if (_thread.joinable()) _thread.join();
+}
@@ -0,0 +1,69 @@
+#include <fmt/core.h>
+
+#include "utils/UnitOfWork.h"
+
+UnitOfWork::UnitOfWork(DBConnection& db) : _db(db), _particleTimes(DBConnection::particleTimesBatch()) {}
+
+UnitOfWork::~UnitOfWork() {
+    if (_active) {
+        rollback();
+    }
+}
+
+bool UnitOfWork::begin() {
+    _errorsAtBegin = _db.errors();
+    _active = _db.beginTransaction();
+    return _active;
+}
+
+void UnitOfWork::updateShortTermState(ShortTermStatePtr sts) {
+    _shortTermStates[sts->id] = sts;
+}
+
+void UnitOfWork::updatePath(PathGraphPtr path) {
+    _paths[std::make_tuple(path->shortTermStateId, path->longTermStateId, path->period)] = path;
+}
+
+void UnitOfWork::addParticleTime(Particle particle, int deviceId, TimePoint expectedTime) {
+    _db.addParticleTime(_particleTimes, particle, deviceId, expectedTime);
+}
+
+void UnitOfWork::markUpdate(UpdatePtr update) {
+    if (update->id < 0) return;
+    _updates[update->id] = update;
+}
+
+bool UnitOfWork::commit() {
+    if (!_active) return false;
+    for (auto& sts : _shortTermStates) {
+        _db.updateShortTermState(sts.second);
+    }
+    for (auto& path : _paths) {
+        _db.updatePath(path.second);
+    }
+    _db.flush(_particleTimes);
+    for (auto& update : _updates) {
+        _db.updateUpdate(update.second);
+    }
+
+    if (_db.errors() != _errorsAtBegin) {
+        fmt::println("Unit of work failed, rolling back");
+        rollback();
+        return false;
+    }
+    _active = false;
+    bool committed = _db.commitTransaction();
+    _shortTermStates.clear();
+    _paths.clear();
+    _updates.clear();
+    return committed;
+}
+
+void UnitOfWork::rollback() {
+    _db.rollbackTransaction();
+    _active = false;
+    _shortTermStates.clear();
+    _paths.clear();
+    _updates.clear();
+    _particleTimes.clear();
+}